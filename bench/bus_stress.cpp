@@ -0,0 +1,349 @@
+// 总线回放与压力测试：按 1228800 波特 8E1 的时序把打印机的帧送进 FrameParser 和 protocol_on_frame，
+// 与总线任务 bus_read 的路径相同。检查每个应答的校验、帧有没有丢失或误判，以及应答时间。在电脑上运行（g++ 命令折成了几行）：
+//   g++ -std=gnu++17 -O2 -Iinclude -Isrc/native bench/bus_stress.cpp src/protocol.cpp src/dispatch.cpp
+//       src/latency.cpp src/metrics.cpp src/web_state.cpp src/sniffer.cpp src/bambu_frame.cpp
+//       src/frame_parser.cpp src/native/hal_native.cpp -o bus_stress
+//   ./bus_stress bench/fixtures/bus_polls.hex [每个场景的帧数] [随机数种子]
+// 时间是模拟的：字节按线速到达，UART 在 FIFO 满或空闲一个字符时交付数据（与 bus_setup 的设置相同），
+// 处理所用的时间取电脑上实际测得的耗时。字节流只由种子决定，可以重现。
+// 有应答错误、丢帧、误判的帧，或轮询场景中应答时间的 p99 超过 latency_deadline_us 时返回 1。
+// 连续发送时总线不空闲，数据要等 FIFO 满才交付，应答时间只作参考。
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "frame_parser.h"
+#include "hal.h"
+#include "latency.h"
+#include "native.h"
+#include "protocol.h"
+
+// 每个字节 1 起始位 + 8 数据位 + 1 校验位 + 1 停止位
+static const double BYTE_NS = 11 * 1e9 / 1228800;
+// UART 的 FIFO 满这么多字节时产生事件（ESP-IDF 的默认值）
+static const size_t UART_FIFO_FULL = 120;
+// 打印机收到应答（或超时）后到发出下一个查询的间隔
+static const double POLL_GAP_NS = 50000;
+
+typedef struct {
+  const char *name;
+  bool burst;                 // 不等应答，帧紧挨着发送
+  uint32_t max_chunk;         // 不为 0 时把数据随机拆成 1..max_chunk 字节交付
+  uint32_t corrupt_percent;   // 出错的帧所占的百分比
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+  {"clean", false, 0, 0},
+  {"split", false, 7, 0},
+  {"burst", true, 0, 0},
+  {"corrupt", false, 0, 5},
+  {"burst+corrupt", true, 16, 5},
+};
+
+// 每行一个帧的十六进制，# 之后是注释
+static bool load_frames(const char *path, std::vector<std::vector<uint8_t>> &frames) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    std::vector<uint8_t> frame;
+    int high = -1;
+    for (char *p = line; *p && *p != '#'; p++) {
+      if (!isxdigit((unsigned char)*p)) {
+        continue;
+      }
+      int v = isdigit((unsigned char)*p) ? *p - '0' : tolower(*p) - 'a' + 10;
+      if (high < 0) {
+        high = v;
+      } else {
+        frame.push_back(high << 4 | v);
+        high = -1;
+      }
+    }
+    if (!frame.empty()) {
+      frames.push_back(frame);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static uint32_t s_random;
+
+static uint32_t random_next() {
+  // xorshift32
+  s_random ^= s_random << 13;
+  s_random ^= s_random >> 17;
+  s_random ^= s_random << 5;
+  return s_random;
+}
+
+static uint32_t random_range(uint32_t lo, uint32_t hi) {
+  return lo + random_next() % (hi - lo + 1);
+}
+
+// 完整发出的帧，以它最后一个字节之后在字节流中的位置为键
+typedef struct {
+  size_t fixture;
+  bool parsed;
+} sent_frame_t;
+
+typedef struct {
+  uint32_t sent = 0;
+  uint32_t corrupted = 0;
+  uint32_t parsed = 0;
+  uint32_t replies = 0;
+  uint32_t bad_replies = 0;       // 校验或长度错误
+  uint32_t reply_mismatches = 0;  // 应答个数与 clean 场景中同一帧不同
+  uint32_t lost = 0;              // 完整发出却没有解析出来
+  uint32_t false_frames = 0;      // 解析出来的帧不是完整发出的帧
+  double busy_ns = 0;
+  double duration_ns = 0;
+  std::vector<double> latency_ns;
+  std::vector<double> resync_ns;
+} result_t;
+
+class Harness {
+public:
+  Harness(const std::vector<std::vector<uint8_t>> &fixtures, std::vector<int> &expected_replies)
+      : m_fixtures(fixtures), m_expected_replies(expected_replies) {}
+
+  void run(const scenario_t &scenario, uint32_t frames, result_t &result);
+
+private:
+  void append(const uint8_t *data, size_t size, double start);
+  void deliver(size_t upto, double time);
+  void on_frame(size_t begin, size_t end, double now);
+
+  const std::vector<std::vector<uint8_t>> &m_fixtures;
+  std::vector<int> &m_expected_replies;
+  result_t *m_result = nullptr;
+
+  FrameParser m_parser;
+  std::vector<uint8_t> m_stream;
+  std::vector<double> m_arrival;    // 每个字节的停止位结束的时间
+  std::map<size_t, sent_frame_t> m_sent;
+  size_t m_delivered = 0;
+  double m_cpu_free = 0;
+  double m_reply_end = 0;
+  size_t m_corrupt_end = 0;         // 尚未恢复的出错数据在字节流中的结束位置，0 表示没有
+};
+
+void Harness::append(const uint8_t *data, size_t size, double start) {
+  for (size_t i = 0; i < size; i++) {
+    m_stream.push_back(data[i]);
+    m_arrival.push_back(start + (i + 1) * BYTE_NS);
+  }
+}
+
+// 把字节流交付到 upto 为止，time 是 UART 事件产生的时间
+void Harness::deliver(size_t upto, double time) {
+  double start = std::max(time, m_cpu_free);
+  auto t0 = std::chrono::steady_clock::now();
+  auto elapsed = [&]() {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  };
+  while (m_delivered < upto) {
+    size_t n = std::min(upto - m_delivered, m_parser.write_space());
+    memcpy(m_parser.write_ptr(), m_stream.data() + m_delivered, n);
+    m_parser.commit(n);
+    m_delivered += n;
+    while (const bambu_data_t *data = m_parser.next()) {
+      size_t end = m_delivered - m_parser.used();
+      size_t size = bambu_size(data);
+      native_uart_writes.clear();
+      protocol_on_frame(data, hal_cycles());
+      on_frame(end - size, end, start + elapsed());
+    }
+  }
+  double busy = elapsed();
+  m_cpu_free = start + busy;
+  m_result->busy_ns += busy;
+}
+
+void Harness::on_frame(size_t begin, size_t end, double now) {
+  result_t &result = *m_result;
+  result.parsed++;
+  auto it = m_sent.find(end);
+  if (it == m_sent.end() || it->second.parsed) {
+    result.false_frames++;
+    return;
+  }
+  sent_frame_t &sent = it->second;
+  sent.parsed = true;
+  // 出错数据之后的第一个完整帧解析出来才算恢复
+  if (m_corrupt_end && begin >= m_corrupt_end) {
+    result.resync_ns.push_back(now - m_arrival[m_corrupt_end - 1]);
+    m_corrupt_end = 0;
+  }
+  int replies = (int)native_uart_writes.size();
+  if (m_expected_replies[sent.fixture] < 0) {
+    m_expected_replies[sent.fixture] = replies;
+  } else if (m_expected_replies[sent.fixture] != replies) {
+    result.reply_mismatches++;
+  }
+  double reply_end = now;
+  for (const auto &reply : native_uart_writes) {
+    const bambu_data_t *r = (const bambu_data_t*)reply.data();
+    result.replies++;
+    if (reply.size() < 4 || bambu_size(r) != reply.size() || !bambu_check(r)) {
+      result.bad_replies++;
+    }
+    reply_end += reply.size() * BYTE_NS;
+  }
+  if (replies) {
+    result.latency_ns.push_back(now - m_arrival[end - 1]);
+    m_reply_end = std::max(m_reply_end, reply_end);
+  }
+}
+
+void Harness::run(const scenario_t &scenario, uint32_t frames, result_t &result) {
+  m_result = &result;
+  m_parser = FrameParser();
+  m_stream.clear();
+  m_arrival.clear();
+  m_sent.clear();
+  m_delivered = 0;
+  m_cpu_free = 0;
+  m_reply_end = 0;
+  m_corrupt_end = 0;
+
+  double line_free = 0;
+  for (uint32_t k = 0; k < frames; k++) {
+    size_t fixture = k % m_fixtures.size();
+    std::vector<uint8_t> frame = m_fixtures[fixture];
+    double start = scenario.burst ? line_free : std::max(line_free, m_reply_end) + POLL_GAP_NS;
+    bool intact = true;
+    if (random_next() % 100 < scenario.corrupt_percent) {
+      result.corrupted++;
+      switch (random_next() % 3) {
+        case 0:
+          // 翻转一位
+          frame[random_next() % frame.size()] ^= 1 << (random_next() % 8);
+          intact = false;
+          break;
+        case 1: {
+          // 帧前的杂散字节，以假的帧头开始，帧本身完整
+          uint8_t noise[8];
+          size_t n = random_range(1, sizeof(noise));
+          noise[0] = BAMBU_HEAD;
+          for (size_t i = 1; i < n; i++) {
+            noise[i] = random_next();
+          }
+          append(noise, n, start);
+          start = m_arrival.back();
+          m_corrupt_end = m_corrupt_end ? m_corrupt_end : m_stream.size();
+          break;
+        }
+        default:
+          // 后半截丢失
+          frame.resize(random_range(1, frame.size() - 1));
+          intact = false;
+          break;
+      }
+    }
+    append(frame.data(), frame.size(), start);
+    line_free = m_arrival.back();
+    result.sent++;
+    if (intact) {
+      m_sent[m_stream.size()] = {fixture, false};
+    } else if (!m_corrupt_end) {
+      m_corrupt_end = m_stream.size();
+    }
+
+    // FIFO 满或拆分出的一段收齐时交付
+    while (true) {
+      size_t chunk = scenario.max_chunk ? random_range(1, scenario.max_chunk) : UART_FIFO_FULL;
+      if (m_stream.size() - m_delivered < chunk) {
+        break;
+      }
+      size_t upto = m_delivered + chunk;
+      deliver(upto, m_arrival[upto - 1]);
+    }
+    // 总线空闲一个字符后交付余下的数据；连续发送时总线不空闲
+    if (!scenario.burst && m_delivered < m_stream.size()) {
+      deliver(m_stream.size(), line_free + BYTE_NS);
+    }
+  }
+  if (m_delivered < m_stream.size()) {
+    deliver(m_stream.size(), line_free + BYTE_NS);
+  }
+  result.duration_ns = std::max(line_free, m_cpu_free);
+  for (const auto &it : m_sent) {
+    if (!it.second.parsed) {
+      result.lost++;
+    }
+  }
+}
+
+static double percentile(std::vector<double> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t i = (size_t)(p / 100 * (values.size() - 1));
+  return values[i];
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <frames.hex> [frames] [seed]\n", argv[0]);
+    return 2;
+  }
+  std::vector<std::vector<uint8_t>> fixtures;
+  if (!load_frames(argv[1], fixtures) || fixtures.empty()) {
+    return 1;
+  }
+  for (const auto &frame : fixtures) {
+    if (frame.size() < 4 || bambu_size((const bambu_data_t*)frame.data()) != frame.size() ||
+        !bambu_check((const bambu_data_t*)frame.data())) {
+      fprintf(stderr, "%s: 帧的长度或校验错误\n", argv[1]);
+      return 1;
+    }
+  }
+  uint32_t frames = argc > 2 ? atoi(argv[2]) : 20000;
+  s_random = argc > 3 ? strtoul(argv[3], nullptr, 0) : 1;
+  if (s_random == 0) {
+    s_random = 1;
+  }
+  native_verbose = false;
+  protocol_setup();
+
+  // 各帧应有的应答个数，由第一个场景（clean）得出
+  std::vector<int> expected_replies(fixtures.size(), -1);
+  Harness harness(fixtures, expected_replies);
+  bool failed = false;
+  printf("%-14s %7s %6s %7s %7s %4s %4s %5s | %9s %9s %6s | %7s %7s %7s | %6s %8s %8s\n", "scenario", "sent",
+         "bad", "parsed", "replies", "err", "lost", "false", "bus f/s", "cpu f/s", "load", "p50 us", "p99 us",
+         "max us", "resync", "avg us", "max us");
+  for (const scenario_t &scenario : scenarios) {
+    result_t result;
+    harness.run(scenario, frames, result);
+    double resync_total = 0;
+    for (double ns : result.resync_ns) {
+      resync_total += ns;
+    }
+    double p99 = percentile(result.latency_ns, 99);
+    printf("%-14s %7u %6u %7u %7u %4u %4u %5u | %9.0f %9.0f %5.1f%% | %7.1f %7.1f %7.1f | %6zu %8.1f %8.1f\n",
+           scenario.name, result.sent, result.corrupted, result.parsed, result.replies,
+           result.bad_replies + result.reply_mismatches, result.lost, result.false_frames,
+           result.sent / (result.duration_ns / 1e9), result.parsed / (result.busy_ns / 1e9),
+           result.busy_ns * 100 / result.duration_ns, percentile(result.latency_ns, 50) / 1000, p99 / 1000,
+           percentile(result.latency_ns, 100) / 1000, result.resync_ns.size(),
+           result.resync_ns.empty() ? 0 : resync_total / result.resync_ns.size() / 1000,
+           percentile(result.resync_ns, 100) / 1000);
+    if (result.bad_replies || result.reply_mismatches || result.lost || result.false_frames ||
+        (!scenario.burst && p99 > latency_deadline_us * 1000.0)) {
+      failed = true;
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+// report 消息解析：不过滤、从堆分配 与 bambu_parse_report（过滤 + 固定缓冲区）的对比，在电脑上运行（g++ 命令折成了几行）：
+//   pio pkg install -e native
+//   g++ -std=gnu++17 -O2 -Iinclude -Isrc/native -I.pio/libdeps/native/ArduinoJson/src bench/mqtt_bench.cpp
+//       src/actuator_timeline.cpp src/bambu.cpp src/json_arena.cpp src/metrics.cpp src/dispatch.cpp src/swap_profiler.cpp src/web_state.cpp
+//       src/native/hal_native.cpp -o mqtt_bench
+//   ./mqtt_bench bench/fixtures/reports.jsonl
+// 堆的用量通过替换 glibc 的 malloc 统计。
+#include <ArduinoJson.h>
+#include <chrono>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "bambu.h"
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+}
+
+static size_t s_heap = 0;
+static size_t s_heap_peak = 0;
+
+static void heap_add(void *p) {
+  if (p) {
+    s_heap += malloc_usable_size(p);
+    if (s_heap > s_heap_peak) {
+      s_heap_peak = s_heap;
+    }
+  }
+}
+
+extern "C" {
+void* malloc(size_t size) {
+  void *p = __libc_malloc(size);
+  heap_add(p);
+  return p;
+}
+
+void* calloc(size_t n, size_t size) {
+  void *p = __libc_calloc(n, size);
+  heap_add(p);
+  return p;
+}
+
+void* realloc(void *ptr, size_t size) {
+  if (ptr) {
+    s_heap -= malloc_usable_size(ptr);
+  }
+  void *p = __libc_realloc(ptr, size);
+  heap_add(p ? p : ptr);
+  return p;
+}
+
+void free(void *ptr) {
+  if (ptr) {
+    s_heap -= malloc_usable_size(ptr);
+  }
+  __libc_free(ptr);
+}
+}
+
+// 原来的做法：整条消息解析进从堆分配的 JsonDocument
+static int parse_full(const std::string &payload) {
+  JsonDocument data;
+  deserializeJson(data, payload.data(), payload.size());
+  return data["print"]["ams_status"] | -1;
+}
+
+static int parse_filtered(const std::string &payload) {
+  bambu_json_arena.reset();
+  JsonDocument data(&bambu_json_arena);
+  bambu_parse_report(data, (const uint8_t*)payload.data(), payload.size());
+  return data["print"]["ams_status"] | -1;
+}
+
+typedef struct {
+  double us;
+  size_t heap_peak;
+} result_t;
+
+template <typename F>
+static result_t run(F parse, const std::string &payload, int rounds) {
+  result_t result;
+  size_t heap = s_heap;
+  s_heap_peak = heap;
+  volatile int sink = parse(payload);
+  result.heap_peak = s_heap_peak - heap;
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    sink = parse(payload);
+  }
+  auto end = std::chrono::steady_clock::now();
+  (void)sink;
+  result.us = std::chrono::duration<double, std::micro>(end - begin).count() / rounds;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <reports.jsonl> [rounds]\n", argv[0]);
+    return 2;
+  }
+  FILE *file = fopen(argv[1], "r");
+  if (!file) {
+    perror(argv[1]);
+    return 1;
+  }
+  int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+  std::vector<std::string> titles;
+  std::vector<std::string> payloads;
+  std::string title;
+  static char line[16384];
+  while (fgets(line, sizeof(line), file)) {
+    size_t n = strcspn(line, "\r\n");
+    line[n] = 0;
+    if (line[0] == '#') {
+      title = line + 1;
+    } else if (n) {
+      titles.push_back(title);
+      payloads.push_back(line);
+    }
+  }
+  fclose(file);
+
+  // 过滤文档第一次使用时分配，不计入每条消息
+  parse_filtered(payloads.front());
+
+  printf("%-6s %7s | %10s %10s | %10s %10s %10s\n", "msg", "bytes", "full us", "full heap", "filter us", "heap", "arena");
+  for (size_t i = 0; i < payloads.size(); i++) {
+    result_t full = run(parse_full, payloads[i], rounds);
+    bambu_json_arena.m_peak = 0;
+    result_t filtered = run(parse_filtered, payloads[i], rounds);
+    printf("%-6zu %7zu | %10.2f %10zu | %10.2f %10zu %10zu  #%s\n", i, payloads[i].size(), full.us, full.heap_peak,
+           filtered.us, filtered.heap_peak, bambu_json_arena.m_peak, titles[i].c_str());
+  }
+  printf("arena %zu bytes, failures %u\n", bambu_json_arena.capacity(), bambu_json_arena.m_failures);
+  return 0;
+}
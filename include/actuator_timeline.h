@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// 按时间先后执行的电机动作与拓竹指令，例如“继续退料 1000ms，然后停止并发布 load”。
+// 由主循环调用 poll() 推进，不会阻塞；/stop 等其它任务可以随时取消。
+// 只通过 hal.h 访问硬件，可以在电脑上编译运行。
+
+#define TIMELINE_MAX_STEPS 8
+
+typedef struct {
+  uint32_t delay_ms;      // 距上一步的时间，第一步从 start() 算起
+  int8_t action;          // ACTUATOR_*，-1 表示不动电机
+  uint8_t lane;
+  const char *publish;    // 动作之后发布的指令，须是静态字符串；nullptr 表示不发布
+} timeline_step_t;
+
+class ActuatorTimeline {
+public:
+  // 替换正在执行的序列，到期的步骤（delay 为 0 的第一步）立即执行
+  // 步骤被复制保存，超过 TIMELINE_MAX_STEPS 时返回 false
+  bool start(const timeline_step_t *steps, size_t count, uint32_t now);
+  // 可以在任意任务中调用，剩余的步骤在下一次 poll() 时丢弃
+  void cancel() { m_cancel++; }
+  // 执行到期的步骤，在主循环中调用
+  void poll(uint32_t now);
+  bool active() const { return m_next < m_count; }
+
+  // 统计：被取消时还有步骤没有执行的序列
+  uint32_t m_cancelled = 0;
+
+private:
+  timeline_step_t m_steps[TIMELINE_MAX_STEPS];
+  size_t m_count = 0;
+  size_t m_next = 0;
+  uint32_t m_due = 0;             // 下一步的时刻，按计划累加，不随 poll 的延迟漂移
+  uint32_t m_generation = 0;      // start() 时的 m_cancel，两者不同说明被取消了
+  std::atomic<uint32_t> m_cancel{0};
+};
+
+extern ActuatorTimeline actuator_timeline;
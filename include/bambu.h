@@ -0,0 +1,68 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json_arena.h"
+
+// 换料状态机：根据打印机通过 mqtt 报告的状态控制电机。
+// 只通过 hal.h 访问硬件，可以在电脑上编译运行。
+
+// 拓竹指令
+extern const char* bambu_unload;
+extern const char* bambu_load;
+extern const char* bambu_done;
+extern const char* bambu_resume;
+extern const char* bambu_gcode_m109;
+extern const char* bambu_pushall;
+
+// 打印机通过 mqtt 发送来的信息
+// -1 表示未知
+extern int print_error;
+extern int ams_status;
+extern int hw_switch_state;
+extern int mc_percent;
+extern char gcode_state[16];
+
+// ZP AMS 状态
+extern int zp_state;
+extern int previous_extruder;
+extern int next_extruder;
+
+// mc_percent 为 BAMBU_SWAP_PERCENT + n 并暂停时换到通道 n；
+// 打印中收到 BAMBU_PRESTAGE_PERCENT + n 时提前把通道 n 的耗材送到汇合处之前的停靠点
+#define BAMBU_SWAP_PERCENT 110
+#define BAMBU_PRESTAGE_PERCENT 120
+
+// 从起点进料到停靠点的时间，0 表示不预送料
+extern uint32_t bambu_prestage_ms;
+// 耗材停在停靠点的通道，每个通道一位：预送料或退料之后置位，进料后清除。
+// 已经在停靠点的通道不再预送料，免得推进汇合处
+extern uint8_t parked_lanes;
+// 预送料还在进行时，总线对这个通道的停止请求不执行
+bool bambu_prestaging(int lane, uint32_t now);
+
+// 换料时的进料耗时（请推入到推入完成），按进料前是否停在停靠点分开统计，用于比较
+typedef struct {
+  uint32_t loads[2];          // [0] 从起点进料，[1] 从停靠点进料
+  uint32_t load_ms[2];        // 累计耗时
+  uint32_t last_load_ms;
+  bool last_prestaged;
+} bambu_swap_stats_t;
+
+extern bambu_swap_stats_t bambu_swap_stats;
+
+// 解析 report 用的固定缓冲区，够放过滤后的文档即可
+#ifndef BAMBU_JSON_ARENA_SIZE
+#define BAMBU_JSON_ARENA_SIZE 8192
+#endif
+
+extern JsonArena bambu_json_arena;
+
+// 只解析用到的字段（print 下的 sequence_id、hw_switch_state、gcode_state、
+// mc_percent、ams_status、print_error），其余部分跳过不存
+DeserializationError bambu_parse_report(JsonDocument &doc, const uint8_t *payload, size_t length);
+
+// 处理打印机发布在 report 主题上的一条消息，运行在主循环中
+void bambu_on_message(const uint8_t *payload, size_t length);
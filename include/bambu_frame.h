@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 拓竹 RS485 总线的帧格式
+typedef struct {
+  uint8_t head;         // 帧头 0x3D
+  uint8_t type;
+  union {
+    struct {            // type: 0x80
+      uint8_t size;
+      uint8_t rv;       // crc8
+      uint8_t cmd;
+      uint8_t data[1];
+    } body_80;
+    struct {            // type: 0x00
+      uint8_t temp2;
+      uint8_t temp3;
+      uint8_t size;     // 4
+      uint8_t temp5;
+      uint8_t rv;       // crc8
+      uint8_t cmd;      // 7
+      uint8_t data[1];
+    } body_00;
+  };
+} bambu_data_t;
+
+static_assert(sizeof(bambu_data_t) == 9, "");
+
+#define BAMBU_HEAD 0x3D
+
+// 帧头（含 crc8）的长度
+inline size_t bambu_head_size(const bambu_data_t *data) {
+  return (data->type & 0x80) ? 4 : 7;
+}
+
+// 最短的合法帧：帧头 + cmd + crc16
+inline size_t bambu_min_size(const bambu_data_t *data) {
+  return bambu_head_size(data) + 3;
+}
+
+inline size_t bambu_size(const bambu_data_t *data) {
+  return (data->type & 0x80) ? data->body_80.size : data->body_00.size;
+}
+
+// 只校验帧头的 crc8，此时帧体可能还没有收全
+bool bambu_check_head(const bambu_data_t *data);
+// 校验整帧的 crc16，调用前须保证已收到 bambu_size(data) 个字节
+bool bambu_check_body(const bambu_data_t *data);
+bool bambu_check(const bambu_data_t *data);
+// 填写 crc8 与 crc16，返回帧长
+size_t bambu_seal(bambu_data_t *data);
+// hex 须能容纳 size * 2 + 1 个字符
+void bambu_to_hex(const uint8_t *data, size_t size, char *hex);
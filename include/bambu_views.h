@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+
+// 各命令帧的字段布局，直接覆盖在收发缓冲区上读写，不做拷贝。
+// 偏移量都是整帧（含帧头）中的位置，用 static_assert 固定下来。
+
+typedef struct {
+  uint8_t index;
+  uint8_t temp;
+  uint8_t id[8];
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t a;
+  uint16_t temperature_min;
+  uint16_t temperature_max;
+  uint8_t name[20];   // 耗材的名称如：PLA
+} filament_t;
+static_assert(sizeof(filament_t) == 38, "");
+
+#pragma pack (1)
+
+// type 带 0x80 的帧头
+typedef struct {
+  uint8_t head;         // 帧头 0x3D
+  uint8_t type;
+  uint8_t size;
+  uint8_t rv;           // crc8
+  uint8_t cmd;
+} bambu_head_80_t;
+static_assert(sizeof(bambu_head_80_t) == 5, "");
+
+// 其它帧的帧头
+typedef struct {
+  uint8_t head;         // 帧头 0x3D
+  uint8_t type;
+  uint8_t seq;          // 应答时原样带回
+  uint8_t temp3;
+  uint8_t size;
+  uint8_t temp5;
+  uint8_t rv;           // crc8
+  uint8_t cmd;
+} bambu_head_00_t;
+static_assert(sizeof(bambu_head_00_t) == 8, "");
+
+// ---- 打印机发来的命令，type 0xC5 ----
+
+// cmd 0x03：查询里程
+typedef struct {
+  bambu_head_80_t h;
+  uint8_t temp5[2];
+  uint8_t read_num;     // 通道
+  uint8_t motion;       // 0x3f 请求退料，0xbf 请求进料
+} bambu_get_meters_t;
+static_assert(offsetof(bambu_get_meters_t, read_num) == 7, "");
+
+// cmd 0x04：查询状态
+typedef struct {
+  bambu_head_80_t h;
+  uint8_t temp5[2];
+  uint8_t motion;       // 同 bambu_get_meters_t
+  uint8_t temp8;
+  uint8_t read_num;
+} bambu_get_status_t;
+static_assert(offsetof(bambu_get_status_t, read_num) == 9, "");
+
+// cmd 0x06：查询通道状态，应答与 cmd 0x04 的相同
+typedef struct {
+  bambu_head_80_t h;
+  uint8_t temp5[2];
+  uint8_t read_num;
+} bambu_cmd_06_t;
+static_assert(offsetof(bambu_cmd_06_t, read_num) == 7, "");
+
+// cmd 0x05：上线检测
+typedef struct {
+  bambu_head_80_t h;
+  uint8_t query[2];     // 01 00
+} bambu_online_detection_t;
+
+// cmd 0x07：NFC 检测
+typedef struct {
+  bambu_head_80_t h;
+  uint8_t temp5;
+  uint8_t echo[2];      // 应答时原样带回
+} bambu_nfc_detect_t;
+
+// cmd 0x08：设置耗材
+typedef struct {
+  bambu_head_80_t h;
+  filament_t filament;
+} bambu_set_filament_t;
+static_assert(sizeof(bambu_set_filament_t) == 43, "");
+
+// ---- 打印机发来的命令，type 0x05 ----
+
+typedef struct {
+  bambu_head_00_t h;
+  uint8_t target;       // 0x12
+  uint8_t temp9;
+  uint8_t sub;          // 子命令 0x06、0x09 ...
+  uint8_t item;
+} bambu_x05_t;
+static_assert(sizeof(bambu_x05_t) == 12, "");
+
+// 子命令 0x09：查询版本，item 0x02 序列号，0x03 固件版本
+typedef bambu_x05_t bambu_get_version_t;
+
+// 子命令 0x06：查询耗材，item 0x11
+typedef struct {
+  bambu_x05_t x;
+  uint8_t temp12[2];
+  uint8_t index;
+} bambu_get_filament_t;
+static_assert(offsetof(bambu_get_filament_t, index) == 14, "");
+
+// ---- 我们的应答，帧长固定，末尾是 crc16 ----
+
+// cmd 0x03
+typedef struct {
+  bambu_head_80_t h;
+  uint8_t temp5[2];
+  uint8_t flag;
+  uint8_t read_num;
+  float meters;
+  uint8_t temp13[29];
+  uint16_t crc16;
+} bambu_meters_res_t;
+static_assert(sizeof(bambu_meters_res_t) == 0x2C, "");
+
+// cmd 0x04
+typedef struct {
+  bambu_head_80_t h;
+  uint8_t temp5[4];
+  uint8_t online;       // 每个通道一位
+  uint8_t ready[2];     // online - nfc
+  uint8_t read_num;
+  uint8_t nfc;
+  uint8_t temp14[5];
+  uint8_t flag;
+  uint8_t read_num2;
+  float meters;
+  uint8_t temp25[33];
+  uint16_t crc16;
+} bambu_status_res_t;
+static_assert(offsetof(bambu_status_res_t, meters) == 21, "");
+static_assert(sizeof(bambu_status_res_t) == 0x3C, "");
+
+// type 0x05 子命令 0x06
+typedef struct {
+  bambu_head_00_t h;
+  uint8_t temp8[6];
+  uint8_t index;
+  uint8_t temp15[17];
+  uint8_t id[8];
+  uint8_t name[20];
+  uint8_t temp60[12];
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t a;
+  uint8_t temp76[16];
+  uint16_t temperature_min;
+  uint16_t temperature_max;
+  uint8_t temp96[48];
+  uint16_t crc16;
+} bambu_filament_res_t;
+static_assert(offsetof(bambu_filament_res_t, id) == 32, "");
+static_assert(offsetof(bambu_filament_res_t, r) == 72, "");
+static_assert(offsetof(bambu_filament_res_t, temperature_min) == 92, "");
+static_assert(sizeof(bambu_filament_res_t) == 0x92, "");
+
+#pragma pack ()
+
+// 收到的帧短于 T 加上 crc16 时返回 nullptr，处理函数因此不会读到帧外
+template <typename T>
+const T* bambu_view(const bambu_data_t *data) {
+  return bambu_size(data) >= sizeof(T) + 2 ? (const T*)data : nullptr;
+}
+
+// 应答缓冲区，长度在编译期检查
+template <typename T, size_t N>
+T* bambu_view(uint8_t (&frame)[N]) {
+  static_assert(sizeof(T) == N, "");
+  return (T*)frame;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+#include "frame_parser.h"
+
+// RS485 总线在独立的任务中处理，由 UART 驱动的事件队列唤醒，
+// 不受 loop() 中 OTA、MQTT、TLS 等阻塞操作的影响。
+// 帧的边界由 UART 硬件的接收超时标出：总线空闲 BUS_RX_TIMEOUT_SYMBOLS 个字符时间后产生事件，
+// 任务被唤醒时整帧已经在缓冲区中。半双工的 RTS 由驱动在发送前后切换。
+// 总线任务与其它部分只通过下面的有界队列（以及每个通道一个的电机动作）交换数据。
+
+#define RS485_RX_PIN  16
+#define RS485_TX_PIN  17
+#define RS485_RTS_PIN 4
+#define RS485_BAUD    1228800
+// 8E1：起始位、8 个数据位、校验位、停止位
+#define RS485_BITS_PER_BYTE 11
+
+// 以下参数可以通过 build_flags 修改
+#ifndef BUS_TASK_STACK_SIZE
+#define BUS_TASK_STACK_SIZE 4096
+#endif
+// 高于 lwIP(18)，低于 WiFi(23)
+#ifndef BUS_TASK_PRIORITY
+#define BUS_TASK_PRIORITY 20
+#endif
+// loop() 运行在 1 号核心上
+#ifndef BUS_TASK_CORE
+#define BUS_TASK_CORE 0
+#endif
+#ifndef BUS_FRAME_QUEUE_SIZE
+#define BUS_FRAME_QUEUE_SIZE 8
+#endif
+// 1 个字符约 9 us（1228800 波特，8E1），帧内的字节是连续发送的
+#ifndef BUS_RX_TIMEOUT_SYMBOLS
+#define BUS_RX_TIMEOUT_SYMBOLS 1
+#endif
+// 驱动的接收缓冲区，任务来不及处理时能放下几帧
+#ifndef BUS_RX_BUFFER_SIZE
+#define BUS_RX_BUFFER_SIZE (FrameParser::CAPACITY * 4)
+#endif
+// 等待应答发完（驱动释放 RTS）的最长时间
+#ifndef BUS_TX_TIMEOUT_MS
+#define BUS_TX_TIMEOUT_MS 10
+#endif
+
+// 与协议中的通道数一致
+#define BUS_LANES 4
+
+// 总线上请求的电机动作（ACTUATOR_*），每个通道只保留最新的一个
+typedef struct {
+  uint8_t action;
+  uint8_t lane;
+} bus_actuator_t;
+
+// 转发到网页上显示的帧
+typedef struct {
+  uint8_t size;
+  uint8_t data[FrameParser::CAPACITY - 1];
+} bus_frame_t;
+
+typedef void (*bus_handler_t)(const bambu_data_t *data, uint32_t rx_cycles);
+
+void bus_setup(bus_handler_t handler);
+
+// 以下函数只在总线任务（即 handler）中调用
+void bus_write(const uint8_t *data, size_t size);
+void bus_post_actuator(uint8_t action, uint8_t lane);
+void bus_post_frame(const bambu_data_t *data);
+
+// 以下函数在其它任务中调用，不会阻塞
+bool bus_receive_actuator(bus_actuator_t *actuator);
+bool bus_receive_frame(bus_frame_t *frame);
+
+// 统计
+extern FrameParser bus_parser;
+extern uint32_t bus_uart_overflows;
+extern uint32_t bus_uart_errors;      // 奇偶校验或帧格式错误
+extern uint32_t bus_dropped_frames;
+// 发送的转换时间：从第一次调用 bus_write 到驱动报告发完、释放 RTS，
+// 减去这些字节按波特率在线上传输所需的时间，剩下的是驱动与 RTS 切换的开销
+extern uint32_t bus_turnaround_us;
+extern uint32_t bus_turnaround_max_us;
+extern uint32_t bus_tx_timeouts;
+extern uint32_t bus_collisions;       // 发送时读回的数据与发出的不同
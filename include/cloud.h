@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 与拓竹的连接：局域网模式直接连打印机的 MQTT，WAN 模式先向云端登录拿到 token 再连云端的 MQTT。
+// TLS 握手和登录都可能阻塞数秒，所以放在独立的任务中进行，失败后按带随机抖动的指数退避重试。
+// 主循环、网页和总线任务只通过下面的函数与它交换数据，都不会阻塞。
+
+// 以下参数可以通过 build_flags 修改
+#ifndef CLOUD_TASK_STACK_SIZE
+#define CLOUD_TASK_STACK_SIZE 8192
+#endif
+// 与 loop() 相同，握手时两者轮流运行
+#ifndef CLOUD_TASK_PRIORITY
+#define CLOUD_TASK_PRIORITY 1
+#endif
+#ifndef CLOUD_TASK_CORE
+#define CLOUD_TASK_CORE 1
+#endif
+// 一次连接或登录最多等这么久
+#ifndef CLOUD_TIMEOUT_MS
+#define CLOUD_TIMEOUT_MS 10000
+#endif
+#ifndef CLOUD_BACKOFF_MIN_MS
+#define CLOUD_BACKOFF_MIN_MS 1000
+#endif
+#ifndef CLOUD_BACKOFF_MAX_MS
+#define CLOUD_BACKOFF_MAX_MS 120000
+#endif
+#ifndef CLOUD_PUBLISH_QUEUE_SIZE
+#define CLOUD_PUBLISH_QUEUE_SIZE 8
+#endif
+// 收到的 report 在这里排队等主循环处理，须能放下两条最长的消息
+#ifndef CLOUD_MESSAGE_BUFFER_SIZE
+#define CLOUD_MESSAGE_BUFFER_SIZE 10240
+#endif
+
+enum {
+  CLOUD_IDLE,         // 没有配置或 WiFi 未连接
+  CLOUD_LOGIN,        // WAN：向云端登录
+  CLOUD_CONNECTING,   // TLS 握手与 MQTT CONNECT
+  CLOUD_CONNECTED,
+  CLOUD_BACKOFF,      // 失败后等待重试
+  CLOUD_STOPPED,      // 账号或密码被拒绝，等待新的配置
+};
+
+// 连接用到的配置，来自 config.json
+typedef struct {
+  String mode;                // "LAN" 或 "WAN"，其它值不连接
+  String broker;              // LAN：打印机的地址
+  String mqtt_password;       // LAN：打印机的访问码
+  String topic_subscribe;
+  String topic_publish;
+  String phone_number;        // WAN：登录用的账号
+  String password;
+  String username;            // WAN：登录得到的用户名与 token
+  String access_token;
+} cloud_config_t;
+
+// 连接的健康状况
+typedef struct {
+  uint8_t state;              // CLOUD_*
+  int32_t last_error;         // 最近一次失败：PubSubClient::state() 或 HTTP 状态码
+  uint32_t failures;          // 连接与登录失败的总次数
+  uint32_t consecutive_failures;
+  uint32_t logins;
+  uint32_t disconnects;       // 连上之后断开的次数
+  uint32_t last_attempt_ms;   // 最近一次连接或登录的耗时
+  uint32_t max_attempt_ms;
+  uint32_t backoff_ms;        // 当前的重试间隔
+  uint32_t connected_at;      // 连上时的 millis()
+  uint32_t messages_dropped;  // 主循环来不及处理而丢弃的 report
+} cloud_health_t;
+
+void cloud_setup();
+
+// 以下函数可以在任意任务中调用
+// 与当前配置不同时断开重连
+void cloud_configure(const cloud_config_t &config);
+bool cloud_connected();
+// 发布到打印机的 request 主题；payload 须一直有效（静态字符串），未连接或队列已满时返回 false
+bool cloud_publish(const char *payload);
+void cloud_health(cloud_health_t *health);
+const char* cloud_state_name(uint8_t state);
+
+// 以下函数在主循环中调用
+// 把收到的 report 交给 bambu_on_message
+void cloud_dispatch();
+// 登录得到了新的用户名与 token（token 失效时为空），需要写回配置
+bool cloud_take_login(String *username, String *access_token);
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdint.h>
+
+// 运行时配置：启动时从 /config.json 读取一次并校验，之后各处直接使用 app_config_t 的字段，不再按键名查 JSON。
+// 修改后推迟一段时间再保存，先写临时文件再改名，掉电时不会留下写了一半的配置。
+// 文件仍是原来的 JSON 格式与键名，旧的配置文件可以直接读取。
+
+#define CONFIG_PATH "/config.json"
+#define CONFIG_TMP_PATH "/config.json.tmp"
+
+// 以下参数可以通过 build_flags 修改
+// 最后一次修改之后这么久才写入，合并连续的修改，减少闪存磨损
+#ifndef CONFIG_SAVE_DELAY_MS
+#define CONFIG_SAVE_DELAY_MS 2000
+#endif
+// 网页状态的推送间隔
+#ifndef WS_INTERVAL_MS
+#define WS_INTERVAL_MS 200
+#endif
+#ifndef MOTOR_PWM_HZ
+#define MOTOR_PWM_HZ 20000
+#endif
+// 送料编码器每个计数对应的耗材长度，由齿轮直径与编码器线数决定
+#ifndef ENCODER_MM_PER_COUNT
+#define ENCODER_MM_PER_COUNT 0.1f
+#endif
+
+// 通道与选择器的数量上限，与协议中的 4 个通道一致
+#define LANES_MAX 4
+#define SELECTORS_MAX 4
+
+// 电机调速参数（键名 motor_*，motor_pwm_hz 重启后生效）
+typedef struct {
+  uint32_t pwm_hz;
+  uint32_t accel_ms;          // 从静止加速到全速的时间，0 表示立即
+  uint32_t decel_ms;          // 从全速减速到静止的时间，0 表示立即刹车
+  uint32_t feed_speed;        // 进料快速阶段的速度，百分比
+  uint32_t feed_fast_ms;      // 快速阶段的时长，之后以 approach_speed 接近挤出机；0 表示一直快速
+  uint32_t approach_speed;
+  uint32_t retract_speed;     // 退料的速度
+} motor_profile_t;
+
+// 一个通道的接线（键名 lanes），引脚为 -1 表示没有接，重启后生效
+typedef struct {
+  int8_t motor[2];            // DRV8833 的两路输入
+  int8_t selector;            // 所属的选择器
+  int8_t side;                // 选中时舵机从初始角度转动的方向，-1 或 1
+  int8_t presence;            // 有料传感器，低电平表示有料
+  int8_t encoder[2];          // 编码器的 A、B 相（也可以用 encoder0_a、encoder0_b 等键设置）
+} lane_config_t;
+
+// 舵机选择器（键名 selectors），0 号的初始角度也可以用 servo1_init 设置
+typedef struct {
+  int8_t pin;
+  int16_t init;
+} selector_config_t;
+
+typedef struct {
+  String wifi_ssid;
+  String wifi_passphrase;
+  // 连接拓竹
+  String mode;                // "LAN"、"WAN" 或空
+  String broker;
+  String mqtt_password;
+  String phone_number;
+  String password;
+  String device_serial;
+  String topic_subscribe;     // 由 device_serial 得出
+  String topic_publish;
+  String username;            // WAN 登录得到的
+  String access_token;
+  // 总线与网页
+  uint32_t reply_deadline_us;
+  uint32_t ws_interval_ms;
+  bool sniffer;
+  // 换料
+  int servo_power;
+  uint32_t prestage_ms;
+  motor_profile_t motor;
+  float encoder_mm_per_count;
+  uint8_t lane_count;
+  lane_config_t lanes[LANES_MAX];
+  uint8_t selector_count;
+  selector_config_t selectors[SELECTORS_MAX];
+} app_config_t;
+
+class Config {
+public:
+  // 读取并校验配置，须在 LittleFS 挂载之后调用
+  void setup();
+
+  // 读写 m_values 时持有，put_config 在网页任务中修改，保存在主循环中进行
+  void lock() { xSemaphoreTakeRecursive(m_mutex, portMAX_DELAY); }
+  void unlock() { xSemaphoreGiveRecursive(m_mutex); }
+
+  // 修改之后、unlock 之前调用：校验，并安排在 CONFIG_SAVE_DELAY_MS 之后保存
+  void save();
+  // 在主循环中调用，到期时写入；重启前以 force 调用立即写入
+  void flush(bool force = false);
+
+  void to_json(JsonDocument &doc);
+  // 解析 lanes、selectors 的 JSON 数组，格式不对时返回 false 且不修改配置
+  bool set_lanes(JsonVariantConst lanes);
+  bool set_selectors(JsonVariantConst selectors);
+  void set_device_serial(const String &serial);
+
+  app_config_t m_values;
+
+  // 统计
+  uint32_t m_writes = 0;
+  uint32_t m_unchanged = 0;   // 内容没变，跳过的写入
+  uint32_t m_write_errors = 0;
+
+private:
+  void load(JsonVariantConst data);
+  void validate();
+  bool read(const char *path, JsonDocument &doc);
+  bool write(const String &text);
+
+  SemaphoreHandle_t m_mutex = nullptr;
+  volatile bool m_dirty = false;
+  volatile uint32_t m_dirty_at = 0;
+  uint32_t m_saved_hash = 0;
+};
+
+extern Config app_config;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 拓竹总线的校验算法，与 robtillaart/CRC 的
+// CRC8(0x39, 0x66, 0, false, false)、CRC16(0x1021, 0x913D, 0, false, false) 结果一致。
+// 查找表在编译期生成，函数不带状态，可以在任意任务中调用，也可以在编译期求值。
+
+#define CRC8_POLY   0x39
+#define CRC8_INIT   0x66
+#define CRC16_POLY  0x1021
+#define CRC16_INIT  0x913D
+
+struct crc8_table_t {
+  uint8_t v[256];
+};
+
+// v[k][x]：字节 x 后面再跟 k 个 0 字节的 crc，用于一次处理 4 个字节
+struct crc16_table_t {
+  uint16_t v[4][256];
+};
+
+constexpr crc8_table_t crc8_make_table() {
+  crc8_table_t t{};
+  for (int i = 0; i < 256; i++) {
+    uint8_t c = i;
+    for (int j = 0; j < 8; j++) {
+      c = (c & 0x80) ? (uint8_t)((c << 1) ^ CRC8_POLY) : (uint8_t)(c << 1);
+    }
+    t.v[i] = c;
+  }
+  return t;
+}
+
+constexpr crc16_table_t crc16_make_table() {
+  crc16_table_t t{};
+  for (int i = 0; i < 256; i++) {
+    uint16_t c = i << 8;
+    for (int j = 0; j < 8; j++) {
+      c = (c & 0x8000) ? (uint16_t)((c << 1) ^ CRC16_POLY) : (uint16_t)(c << 1);
+    }
+    t.v[0][i] = c;
+  }
+  for (int k = 1; k < 4; k++) {
+    for (int i = 0; i < 256; i++) {
+      uint16_t c = t.v[k - 1][i];
+      t.v[k][i] = (uint16_t)(c << 8) ^ t.v[0][c >> 8];
+    }
+  }
+  return t;
+}
+
+inline constexpr crc8_table_t crc8_table = crc8_make_table();
+inline constexpr crc16_table_t crc16_table = crc16_make_table();
+
+constexpr uint8_t crc8(const uint8_t *data, size_t len, uint8_t crc = CRC8_INIT) {
+  for (size_t i = 0; i < len; i++) {
+    crc = crc8_table.v[crc ^ data[i]];
+  }
+  return crc;
+}
+
+// 传入上一段的结果作为 crc 可以分段计算
+constexpr uint16_t crc16(const uint8_t *data, size_t len, uint16_t crc = CRC16_INIT) {
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    crc = crc16_table.v[3][(crc >> 8) ^ data[i]]
+        ^ crc16_table.v[2][(crc & 0xFF) ^ data[i + 1]]
+        ^ crc16_table.v[1][data[i + 2]]
+        ^ crc16_table.v[0][data[i + 3]];
+  }
+  for (; i < len; i++) {
+    crc = (uint16_t)(crc << 8) ^ crc16_table.v[0][(crc >> 8) ^ data[i]];
+  }
+  return crc;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "bambu_frame.h"
+
+// 按 (type, cmd, 子命令) 把帧分发给处理函数，每次分发只查一次表。
+// type 0xC5 的帧按 cmd 查表，type 0x05 的帧按子命令 data[2] 查表，
+// 其它帧和没有注册的命令交给默认处理函数。
+
+typedef void (*dispatch_handler_t)(const bambu_data_t *data);
+
+// type 为 0xC5 时 cmd 是 body_80.cmd，为 0x05 时是子命令；其它 type 返回 false
+bool dispatch_register(uint8_t type, uint8_t cmd, dispatch_handler_t handler);
+// 默认处理函数只计数，见 dispatch_unknown
+void dispatch_set_default(dispatch_handler_t handler);
+void dispatch_frame(const bambu_data_t *data);
+
+// 没有处理函数的帧数
+extern uint32_t dispatch_unknown;
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <initializer_list>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+#include "crc.h"
+
+// 在编译期拼装应答帧并算好 crc8/crc16。
+// 内容固定的帧直接发送，运行时不再计算；只有个别字节会变的帧用 set_seq/set_head/set_body 修改，
+// 校验码利用 crc 的线性按差值增量更新，每个字节只需查一两次表。
+
+// 字节 x 之后再跟 K 个 0 字节时对 crc 的贡献（初值为 0）
+template <size_t K>
+struct crc8_delta {
+  static constexpr crc8_table_t make() {
+    crc8_table_t t{};
+    for (int x = 0; x < 256; x++) {
+      uint8_t c = crc8_table.v[x];
+      for (size_t k = 0; k < K; k++) {
+        c = crc8_table.v[c];
+      }
+      t.v[x] = c;
+    }
+    return t;
+  }
+  static constexpr crc8_table_t table = make();
+};
+
+struct crc16_delta_table_t {
+  uint16_t v[256];
+};
+
+template <size_t K>
+struct crc16_delta {
+  static constexpr crc16_delta_table_t make() {
+    crc16_delta_table_t t{};
+    for (int x = 0; x < 256; x++) {
+      uint16_t c = crc16_table.v[0][x];
+      for (size_t k = 0; k < K; k++) {
+        c = (uint16_t)(c << 8) ^ crc16_table.v[0][c >> 8];
+      }
+      t.v[x] = c;
+    }
+    return t;
+  }
+  static constexpr crc16_delta_table_t table = make();
+};
+
+template <size_t N>
+class BambuFrame {
+  static_assert(N >= 7 && N <= 0xFF, "");
+public:
+  uint8_t data[N] = {};
+
+  // type 带 0x80 的帧：3D type size crc8 cmd ...
+  static constexpr BambuFrame head_80(uint8_t type, uint8_t cmd) {
+    BambuFrame frame;
+    frame.data[0] = BAMBU_HEAD;
+    frame.data[1] = type;
+    frame.data[2] = N;
+    frame.data[4] = cmd;
+    return frame;
+  }
+
+  // 其它帧：3D type seq 00 size 00 crc8 cmd ...
+  static constexpr BambuFrame head_00(uint8_t type, uint8_t seq, uint8_t cmd) {
+    BambuFrame frame;
+    frame.data[0] = BAMBU_HEAD;
+    frame.data[1] = type;
+    frame.data[2] = seq;
+    frame.data[4] = N;
+    frame.data[7] = cmd;
+    return frame;
+  }
+
+  constexpr BambuFrame& u8(size_t offset, uint8_t value) {
+    data[offset] = value;
+    return *this;
+  }
+
+  constexpr BambuFrame& bytes(size_t offset, std::initializer_list<uint8_t> values) {
+    for (uint8_t value : values) {
+      data[offset++] = value;
+    }
+    return *this;
+  }
+
+  // 不含结尾的 0
+  constexpr BambuFrame& str(size_t offset, const char *s) {
+    while (*s) {
+      data[offset++] = *s++;
+    }
+    return *this;
+  }
+
+  // 帧头 crc8 所在的字节，也是帧头的长度
+  constexpr size_t head_size() const {
+    return (data[1] & 0x80) ? 3 : 6;
+  }
+
+  constexpr BambuFrame seal() const {
+    BambuFrame frame = *this;
+    size_t head = head_size();
+    frame.data[head] = crc8(frame.data, head);
+    uint16_t rv = crc16(frame.data, N - 2);
+    frame.data[N - 2] = rv & 0xFF;
+    frame.data[N - 1] = rv >> 8;
+    return frame;
+  }
+
+  // 修改 type 不带 0x80 的帧的序号（第 2 字节），连带帧头的 crc8
+  void set_seq(uint8_t seq) {
+    uint8_t d = data[2] ^ seq;
+    data[2] = seq;
+    uint8_t d8 = crc8_delta<3>::table.v[d];
+    data[6] ^= d8;
+    patch_crc16(crc16_delta<N - 5>::table.v[d] ^ crc16_delta<N - 9>::table.v[d8]);
+  }
+
+  // 修改 type 不带 0x80 的帧帧头中的第 4、5 字节，连带第 6 字节的 crc8 与 crc16。
+  // 对 type 带 0x80 的帧调用时不做修改
+  template <size_t P>
+  void set_head(uint8_t value) {
+    static_assert(P == 4 || P == 5, "");
+    if (data[1] & 0x80) {
+      return;
+    }
+    uint8_t d = data[P] ^ value;
+    data[P] = value;
+    uint8_t d8 = crc8_delta<5 - P>::table.v[d];
+    data[6] ^= d8;
+    patch_crc16(crc16_delta<N - 3 - P>::table.v[d] ^ crc16_delta<N - 9>::table.v[d8]);
+  }
+
+  // 修改帧头之后的第 P 个字节（从 0 数起），连带 crc16。
+  // P 须在帧头的 crc8 之后（type 带 0x80 的帧从 4 起，其它帧从 7 起），否则不做修改
+  template <size_t P>
+  void set_body(uint8_t value) {
+    static_assert(P >= 4 && P < N - 2, "");
+    if (P <= head_size()) {
+      return;
+    }
+    uint8_t d = data[P] ^ value;
+    data[P] = value;
+    patch_crc16(crc16_delta<N - 3 - P>::table.v[d]);
+  }
+
+private:
+  void patch_crc16(uint16_t d) {
+    data[N - 2] ^= d & 0xFF;
+    data[N - 1] ^= d >> 8;
+  }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+
+// RS485 总线的帧组装器
+// 环形缓冲区在 [N, 2N) 还存有一份 [0, N) 的镜像，所以任何不超过 N 字节的帧
+// 在缓冲区中都是连续的，可以直接把指向缓冲区的指针交给处理函数，不必搬移数据。
+class FrameParser {
+public:
+  // 必须是 2 的幂，且不小于最长的帧（size 字段只有一个字节）
+  static const size_t CAPACITY = 256;
+
+  // 可以直接写入的连续空间，写完后调用 commit
+  uint8_t* write_ptr() { return m_buffer + (m_tail & (CAPACITY - 1)); }
+  size_t write_space() const;
+  void commit(size_t n);
+
+  // 取出下一个校验通过的完整帧，没有则返回 nullptr
+  // 返回的指针在下一次写入之前有效
+  const bambu_data_t* next();
+
+  size_t used() const { return m_tail - m_head; }
+
+  // 统计
+  uint32_t m_frames = 0;
+  uint32_t m_crc8_errors = 0;
+  uint32_t m_crc16_errors = 0;
+  uint32_t m_size_errors = 0;
+  uint32_t m_dropped_bytes = 0;   // 重新同步时丢弃的字节
+
+private:
+  void skip(size_t n) {
+    m_head += n;
+    m_dropped_bytes += n;
+  }
+
+  uint8_t m_buffer[CAPACITY * 2];
+  // 自由增长的读写计数，取模后才是下标
+  uint32_t m_head = 0;
+  uint32_t m_tail = 0;
+};
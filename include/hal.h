@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+
+// 硬件抽象层
+// protocol.cpp（总线协议）与 bambu.cpp（换料状态机）只通过这些函数访问硬件，
+// 固件中由 main.cpp 实现，电脑上由 native/hal_native.cpp 中模拟的驱动实现。
+
+enum {
+  ACTUATOR_STOP,
+  ACTUATOR_FORWARD,
+  ACTUATOR_BACKWARD,
+};
+
+// ACTUATOR_STOP 的通道号为 LANE_ALL 时停下所有通道
+#define LANE_ALL 0xff
+
+// 时钟
+uint32_t hal_millis();
+uint32_t hal_micros();
+// CPU 周期计数，用于低开销的计时
+uint32_t hal_cycles();
+uint32_t hal_cycles_per_us();
+
+void hal_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// 保护在不同任务间共享、改动很快的数据（固件中是关中断的自旋锁），
+// 两者之间不能阻塞、不能调用 hal_log，也不能嵌套
+void hal_critical_enter();
+void hal_critical_exit();
+
+// 以下函数在总线任务中调用
+void hal_uart_write(const uint8_t *data, size_t size);
+// 通道的编码器累计的送料长度（米，进料为正），没有编码器时返回 false
+bool hal_feed_meters(uint8_t lane, float *meters);
+// 每个通道一位：有耗材（在线），以及正在读取 NFC 标签
+void hal_lane_flags(uint8_t *online, uint8_t *nfc);
+// 电机动作交给主循环执行
+void hal_bus_actuator(uint8_t action, uint8_t lane);
+// 转发到网页上显示
+void hal_monitor_frame(const bambu_data_t *data);
+
+// 以下函数在主循环中调用
+void hal_actuator(uint8_t action, uint8_t lane);
+// 发布到打印机的 request 主题，payload 须是一直有效的字符串（实际发送在另一个任务中）
+bool hal_mqtt_publish(const char *payload);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 给 JsonDocument 用的分配器：在固定大小的缓冲区中顺序分配，不使用堆。
+// 只有最后一块能原地扩大或归还，其余的释放要等 reset() 一起回收，
+// 所以必须在使用它的 JsonDocument 都析构以后再 reset()。
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  JsonArena(uint8_t *buffer, size_t capacity) : m_buffer(buffer), m_capacity(capacity) {}
+
+  void* allocate(size_t size) override;
+  void deallocate(void *ptr) override;
+  void* reallocate(void *ptr, size_t new_size) override;
+
+  void reset() {
+    m_size = 0;
+    m_last = NONE;
+  }
+
+  size_t size() const { return m_size; }
+  size_t capacity() const { return m_capacity; }
+
+  // 统计
+  size_t m_peak = 0;
+  uint32_t m_failures = 0;    // 空间不足，ArduinoJson 会报告 NoMemory
+
+private:
+  static const size_t ALIGN = 8;
+  static const size_t HEADER = ALIGN;   // 每块前面记录块的长度
+  static const size_t NONE = (size_t)-1;
+
+  static size_t align(size_t n) { return (n + ALIGN - 1) & ~(ALIGN - 1); }
+  size_t block_size(size_t offset) const { return *(const size_t*)(m_buffer + offset); }
+
+  uint8_t *m_buffer;
+  size_t m_capacity;
+  size_t m_size = 0;
+  size_t m_last = NONE;       // 最后一块的块头位置
+};
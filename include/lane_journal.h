@@ -0,0 +1,101 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_views.h"
+
+// 通道状态日志：打印机设置的耗材（cmd 0x08）、当前通道的送料长度与换料用到的通道号，
+// 重启或掉电后在第一次总线查询之前恢复，打印机不用重新设置耗材。
+// 只追加写入 LittleFS 上的 JOURNAL_PATH，每条记录带 CRC32，断电时写坏的尾部在恢复时丢弃；
+// 文件超过 JOURNAL_COMPACT_BYTES 时写一份完整的快照替换它。
+
+#define JOURNAL_PATH "/lanes.journal"
+#define JOURNAL_TMP_PATH "/lanes.journal.tmp"
+
+// 以下参数可以通过 build_flags 修改
+// 耗材或通道号变化后等这么久再写，连续的设置合成一次写入
+#ifndef JOURNAL_DELAY_MS
+#define JOURNAL_DELAY_MS 1000
+#endif
+// 送料长度变化频繁，最多这么久记录一次，变化小于 JOURNAL_METERS_STEP（米）时不记录
+#ifndef JOURNAL_METERS_INTERVAL_MS
+#define JOURNAL_METERS_INTERVAL_MS 30000
+#endif
+#ifndef JOURNAL_METERS_STEP
+#define JOURNAL_METERS_STEP 0.05f
+#endif
+#ifndef JOURNAL_COMPACT_BYTES
+#define JOURNAL_COMPACT_BYTES 8192
+#endif
+
+enum {
+  JOURNAL_FILAMENT = 1,   // filament_t
+  JOURNAL_METERS,         // journal_meters_t
+  JOURNAL_EXTRUDER,       // journal_extruder_t
+};
+
+#pragma pack (1)
+
+// 记录的格式：头、size 字节的内容、对头和内容计算的 CRC32
+typedef struct {
+  uint8_t magic;          // JOURNAL_MAGIC
+  uint8_t type;           // JOURNAL_*
+  uint8_t size;
+} journal_head_t;
+
+typedef struct {
+  int8_t lane;
+  float meters;
+} journal_meters_t;
+
+typedef struct {
+  int8_t previous;
+  int8_t next;
+} journal_extruder_t;
+
+#pragma pack ()
+
+#define JOURNAL_MAGIC 0xA5
+
+class LaneJournal {
+public:
+  // 启动时在 LittleFS 挂载之后、bus_setup 之前调用
+  void restore();
+  // 在主循环中调用；force 时不等待，立即写入所有变化（重启之前）。
+  // 重启与升级的回调在网页任务中以 force 调用，持有锁，与主循环的 flush 不会同时写文件
+  void flush(uint32_t now, bool force = false);
+
+  uint32_t m_restored = 0;      // 启动时读到的有效记录
+  uint32_t m_corrupt = 0;       // 启动时丢弃的损坏尾部
+  uint32_t m_restore_us = 0;
+  uint32_t m_appends = 0;       // 追加写入的次数，每次可以包含多条记录
+  uint32_t m_records = 0;
+  uint32_t m_compactions = 0;
+  uint32_t m_write_errors = 0;
+
+private:
+  void lock() { xSemaphoreTakeRecursive(m_mutex, portMAX_DELAY); }
+  void unlock() { xSemaphoreGiveRecursive(m_mutex); }
+  void apply(uint8_t type, const uint8_t *payload);
+  void flush_locked(uint32_t now, bool force);
+  bool append(const uint8_t *data, size_t size);
+  bool compact();
+  size_t snapshot(uint8_t *buffer);
+
+  // 已经写入日志的状态
+  filament_t m_filaments[4] = {};
+  int8_t m_previous = 0;
+  int8_t m_next = 0;
+  int8_t m_lane = -1;
+  float m_meters = 0;
+  size_t m_size = 0;
+  bool m_changed = false;
+  uint32_t m_changed_at = 0;
+  uint32_t m_meters_at = 0;
+  SemaphoreHandle_t m_mutex = nullptr;
+};
+
+extern LaneJournal lane_journal;
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+
+// 从收到打印机的命令到发完应答的耗时，按命令分别记录在固定分桶的直方图中。
+// 记录只在总线任务中进行，不分配内存。
+
+// 超过这个时间的应答计入 missed，可以通过 put_config 的 reply_deadline_us 修改
+#ifndef LATENCY_DEADLINE_US
+#define LATENCY_DEADLINE_US 1000
+#endif
+
+enum {
+  LATENCY_CMD_03,
+  LATENCY_CMD_04,
+  LATENCY_CMD_05,
+  LATENCY_CMD_06,
+  LATENCY_CMD_08,
+  LATENCY_X05_06,
+  LATENCY_X05_09,
+  LATENCY_CMD_COUNT,
+};
+
+// 小于 8us 每微秒一个桶，之后每个 2 的幂分成 4 个桶，最大约 1s
+#define LATENCY_BUCKETS 80
+
+typedef struct {
+  uint32_t buckets[LATENCY_BUCKETS];
+  uint32_t count;
+  uint32_t max_us;
+  uint32_t missed;
+} latency_histogram_t;
+
+extern const char* const latency_names[LATENCY_CMD_COUNT];
+extern latency_histogram_t latency_histograms[LATENCY_CMD_COUNT];
+extern uint32_t latency_deadline_us;
+
+// 帧对应的 LATENCY_*，-1 表示不统计
+int latency_cmd(const bambu_data_t *data);
+void latency_record(int cmd, uint32_t us);
+// 第 p 百分位所在桶的上界，单位微秒
+uint32_t latency_percentile(const latency_histogram_t *histogram, uint32_t p);
+// 在下一次记录前清零，可以在其它任务中调用
+void latency_reset();
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+
+// 运行统计，通过 /metrics 以 Prometheus 文本格式输出
+
+typedef struct {
+  uint8_t type;
+  uint8_t cmd;          // type-0x05 帧记录子命令 data[2]
+  uint32_t count;
+} metrics_frame_t;
+
+// 不同的 (type, cmd) 最多记录这么多种，其余的计入 frames_other
+#define METRICS_FRAME_KINDS 16
+
+typedef struct {
+  metrics_frame_t frames[METRICS_FRAME_KINDS];
+  uint32_t frames_other;
+  uint32_t frames_rejected;   // 帧长不足，没有交给处理函数
+  uint32_t replies;
+  uint32_t mqtt_messages;
+  uint32_t mqtt_bytes;
+  uint32_t mqtt_parse_errors;
+  uint32_t mqtt_connects;
+  uint32_t mqtt_connect_failures;
+  uint32_t ws_dropped;
+  uint32_t ws_coalesced;      // 推送间隔内被后来的总线帧覆盖
+  uint32_t loop_us;
+  uint32_t loop_max_us;
+  uint32_t first_reply_us;    // 复位后第一次应答总线的时间，0 表示还没有应答过
+} metrics_t;
+
+extern metrics_t metrics;
+
+// 在总线任务中调用
+void metrics_count_frame(const bambu_data_t *data);
+
+// 在预先分配的缓冲区中生成文本，空间不足时截断
+class MetricsWriter {
+public:
+  MetricsWriter(char *buffer, size_t capacity) : m_buffer(buffer), m_capacity(capacity) {
+    m_buffer[0] = 0;
+  }
+  // type 为 counter 或 gauge
+  void header(const char *name, const char *type, const char *help);
+  void value(const char *name, uint32_t value);
+  void value(const char *name, const char *labels, uint32_t value);
+  void gauge(const char *name, const char *help, uint32_t value);
+  void counter(const char *name, const char *help, uint32_t value);
+
+  const char* c_str() const { return m_buffer; }
+  size_t size() const { return m_size; }
+
+private:
+  void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  char *m_buffer;
+  size_t m_capacity;
+  size_t m_size = 0;
+};
+
+// 输出与硬件无关的统计
+void metrics_render(MetricsWriter &writer);
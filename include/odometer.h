@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// 送料编码器，由 PCNT 外设计数，不占用 CPU；16 位计数器溢出时在中断中累加。
+// 接了 A、B 两相时按正交信号计数（进料为正）；只接 A 相时计数只增不减，
+// 方向取自电机的转向（odometer_set_direction）。
+
+#define ODOMETER_LANES 4
+
+// pin_b 为 -1 表示只接 A 相；返回 false 表示 PCNT 配置失败
+bool odometer_setup(uint8_t lane, int pin_a, int pin_b);
+bool odometer_configured(uint8_t lane);
+// 累计的计数，进料为正；可以在任意任务中调用
+int32_t odometer_count(uint8_t lane);
+// 只接 A 相时使用：1 进料，-1 退料，0 停止
+void odometer_set_direction(uint8_t lane, int8_t direction);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bambu_frame.h"
+#include "bambu_views.h"
+
+// 总线协议：应答打印机的查询。只通过 hal.h 访问硬件，可以在电脑上编译运行。
+
+typedef struct {
+  int motion_set;
+  float meters;           // 通道被选中以来的送料长度，进料为正
+  float odometer_base;    // 被选中时编码器的读数
+} filament_ex_t;
+
+extern filament_t filaments[4];
+extern filament_ex_t filaments_ex[4];
+// filaments 的修改计数，总线任务写入期间为奇数
+extern std::atomic<uint32_t> filaments_seq;
+
+// 在其它任务中读取 filaments 的完整副本
+void protocol_filaments(filament_t out[4]);
+// 最近一次查询里程或状态的通道，重启后还没有查询过时为 -1
+int protocol_active_lane();
+// 以下两个函数恢复重启前的状态，须在 bus_setup 之前调用
+void protocol_restore_filament(const filament_t &filament);
+// 编码器重启后从 0 开始计数，按恢复的长度调整基准，之后的读数接着累计
+void protocol_restore_meters(int lane, float meters);
+
+// 注册各命令的处理函数，须在 bus_setup 之前调用
+void protocol_setup();
+
+// 处理一个校验通过的帧，运行在总线任务中
+// rx_cycles 是收到这个帧时的 hal_cycles()，用于统计应答耗时
+void protocol_on_frame(const bambu_data_t *data, uint32_t rx_cycles);
@@ -1,5 +1,8 @@
 
 #pragma once
 
+// 不等待 NTP，同步在后台进行
 void time_setup();
+// 在主循环中调用，同步成功后打印一次时间
+void time_poll();
 void little_fs_setup();
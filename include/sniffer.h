@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 总线抓包：把收发的原始帧连同时间戳和方向存进固定大小的环形缓冲区，满了覆盖最旧的记录。
+// 只有总线任务写入；其它任务各自持有读游标读取，读到一半被覆盖的记录会被丢弃。
+//
+// 抓包文件是 SNIFFER_MAGIC 加上按时间顺序排列的记录，记录格式与缓冲区中相同：
+//   uint32_t us（小端）、uint8_t dir、uint8_t size、size 字节的帧
+
+#define SNIFFER_MAGIC "BBLCAP1"     // 连同结尾的 0 共 8 字节
+
+enum {
+  SNIFFER_RX,   // 打印机发来的
+  SNIFFER_TX,   // 我们的应答
+};
+
+#pragma pack (1)
+typedef struct {
+  uint32_t us;
+  uint8_t dir;
+  uint8_t size;
+} sniffer_record_t;
+#pragma pack ()
+static_assert(sizeof(sniffer_record_t) == 6, "");
+
+class SnifferRing {
+public:
+  // capacity 须是 2 的幂；未调用 begin 时 record 什么也不做
+  void begin(uint8_t *buffer, size_t capacity);
+  bool ready() const { return m_buffer != nullptr; }
+
+  void record(uint8_t dir, const uint8_t *data, size_t size, uint32_t us);
+
+  // 从 *cursor 开始复制完整的记录，最多 size 字节，并前移 *cursor
+  // 游标落后于最旧的记录时从最旧的记录开始，返回复制的字节数
+  size_t read(uint32_t *cursor, uint8_t *buffer, size_t size);
+
+  uint32_t head() const { return __atomic_load_n(&m_head, __ATOMIC_ACQUIRE); }
+  uint32_t tail() const { return __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE); }
+
+  // 统计
+  uint32_t m_records = 0;
+  uint32_t m_overwritten = 0;   // 没被读走就被覆盖的记录
+
+private:
+  void copy_out(uint32_t pos, uint8_t *out, size_t n) const;
+
+  uint8_t *m_buffer = nullptr;
+  size_t m_capacity = 0;
+  // 自由增长的位置，取模后才是缓冲区下标
+  uint32_t m_head = 0;
+  uint32_t m_tail = 0;
+};
+
+extern SnifferRing sniffer;
+// 为 false 时不记录
+extern volatile bool sniffer_enabled;
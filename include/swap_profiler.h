@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hal.h"
+
+// 换料过程的计时：按打印机报告的 ams_status 把每次换料分成若干阶段，
+// 记录每次转换的时间、涉及的通道、电机转动的时间与重试次数，保留最近 SWAP_HISTORY 次。
+// 只在主循环中写入；网页任务通过 snapshot() 读取。
+// 不访问硬件，可以在电脑上编译运行。
+
+// 以下参数可以通过 build_flags 修改
+#ifndef SWAP_HISTORY
+#define SWAP_HISTORY 16
+#endif
+// 一次换料最多记录这么多次转换，之后的只计入各阶段的耗时
+#ifndef SWAP_MAX_TRANSITIONS
+#define SWAP_MAX_TRANSITIONS 16
+#endif
+// 这么久没有新的状态就认为换料被放弃了，在下一次收到状态时结束
+#ifndef SWAP_TIMEOUT_MS
+#define SWAP_TIMEOUT_MS 600000
+#endif
+
+enum {
+  SWAP_WAIT,        // 暂停后等打印机开始换料
+  SWAP_HEATING,     // 258
+  SWAP_CUTTING,     // 259
+  SWAP_PULL,        // 260 请回抽
+  SWAP_PUSH,        // 261 请推入
+  SWAP_DETECTED,    // 262 检测到进料
+  SWAP_PURGE,       // 263 清理
+  SWAP_UNLOADED,    // 0 完成退料
+  SWAP_OTHER,       // 其它 ams_status
+  SWAP_PHASES,
+};
+
+typedef struct {
+  uint16_t ams_status;
+  uint32_t at_ms;               // 距换料开始的时间
+} swap_transition_t;
+
+typedef struct {
+  uint32_t id;                  // 从 1 开始递增
+  uint32_t start_ms;
+  uint32_t total_ms;            // 到完成（768）或放弃为止
+  uint32_t phase_ms[SWAP_PHASES];
+  uint32_t motor_ms;            // 电机转动的时间
+  int8_t from_lane;
+  int8_t to_lane;
+  uint8_t retries;              // 回到已经经过的阶段的次数
+  uint8_t errors;               // 换料中收到的 print_error
+  bool completed;               // false 表示被放弃或被下一次换料打断
+  uint8_t transition_count;
+  swap_transition_t transitions[SWAP_MAX_TRANSITIONS];
+} swap_record_t;
+
+// 所有结束了的换料的累计
+typedef struct {
+  uint32_t swaps;
+  uint32_t completed;
+  uint32_t total_ms;            // 只计完成了的
+  uint32_t max_ms;
+  uint32_t phase_ms[SWAP_PHASES];
+  uint32_t phase_max_ms[SWAP_PHASES];
+  uint32_t motor_ms;
+  uint32_t retries;
+  uint32_t errors;
+} swap_totals_t;
+
+typedef struct {
+  swap_record_t records[SWAP_HISTORY];    // 从旧到新
+  size_t count;
+  bool active;
+  swap_record_t current;                  // active 时是正在进行的换料
+  uint8_t phase;                          // 以及它所处的阶段和进入的时间
+  uint32_t phase_start;
+  swap_totals_t totals;
+} swap_snapshot_t;
+
+const char* swap_phase_name(uint8_t phase);
+
+class SwapProfiler {
+public:
+  // 以下函数在主循环中调用
+  // 开始一次换料，还没结束的上一次记为放弃
+  void begin(int from_lane, int to_lane, uint32_t now);
+  // 打印机报告的 ams_status；没有在换料时，换料中的状态（258..263）会开始一次换料，
+  // 768 结束换料
+  void status(int ams_status, int from_lane, int to_lane, uint32_t now);
+  void error(uint32_t now);
+  // 是否有电机在转，变化时调用
+  void motor(bool running, uint32_t now);
+  bool active() const { return m_active; }
+
+  // 可以在其它任务中调用
+  void snapshot(swap_snapshot_t *out) const;
+
+private:
+  void enter(uint8_t phase, uint16_t ams_status, uint32_t now);
+  void finish(bool completed, uint32_t now);
+  // 网页任务的优先级高于 loop()，不能让它等一个被它抢占的写入，所以用关中断的锁而不是自旋重读
+  void write_begin() { hal_critical_enter(); }
+  void write_end() { hal_critical_exit(); }
+
+  swap_record_t m_records[SWAP_HISTORY];
+  size_t m_head = 0;                // 下一条记录的位置
+  size_t m_count = 0;
+  swap_totals_t m_totals = {};
+  swap_record_t m_current = {};
+  bool m_active = false;
+  uint8_t m_phase = SWAP_WAIT;
+  int m_status = -1;
+  uint32_t m_phase_start = 0;
+  uint16_t m_visited = 0;           // 经过的阶段，每个阶段一位
+  uint32_t m_next_id = 1;
+  bool m_motor_running = false;
+  uint32_t m_motor_since = 0;
+};
+
+extern SwapProfiler swap_profiler;
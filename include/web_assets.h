@@ -0,0 +1,27 @@
+#pragma once
+
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+
+// 网页文件：tools/build_web.py 把 data/ 精简、gzip 后放在 LittleFS 的 WEB_ASSETS_DIR 下，
+// 启动时读入清单，每个文件注册一个路由。应答带 Content-Encoding、强 ETag 与 Cache-Control，
+// 浏览器带着相同的 If-None-Match 再来时直接回 304，不读文件系统。
+
+#define WEB_ASSETS_DIR "/www"
+#define WEB_ASSETS_MANIFEST WEB_ASSETS_DIR "/manifest.json"
+
+// 以下参数可以通过 build_flags 修改
+#ifndef WEB_ASSETS_MAX
+#define WEB_ASSETS_MAX 16
+#endif
+// 每次使用前都向设备确认，文件系统更新后立即生效；没有变化时只花一个 304
+#ifndef WEB_CACHE_CONTROL
+#define WEB_CACHE_CONTROL "no-cache"
+#endif
+
+// 没有清单（旧的文件系统镜像）时返回 false
+bool web_assets_setup(AsyncWebServer &server, fs::FS &fs);
+
+// 统计
+extern uint32_t web_assets_sent;
+extern uint32_t web_assets_not_modified;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 网页上显示的状态快照。各处只更新快照，由主循环按固定间隔把变化合并成一条消息推送，
+// 同一字段在两次推送之间的多次变化只发最后一个值。
+class WebState {
+public:
+  static const size_t FIELDS = 8;
+  static const size_t VALUE_SIZE = 24;    // JSON 编码后的值，超长的字符串会被截断
+
+  // key 须是常量字符串，只保存指针
+  void set(const char *key, int value);
+  void set(const char *key, const char *value);
+
+  bool dirty() const;
+  void clear_dirty();
+
+  // 生成 {"key": value, ...}，full 为 false 时只含变化了的字段
+  // 返回长度，没有内容或空间不足时返回 0
+  size_t render(char *buffer, size_t size, bool full) const;
+
+  // 统计：被后来的值覆盖、没有单独推送的更新
+  uint32_t m_coalesced = 0;
+
+private:
+  typedef struct {
+    const char *key;
+    char value[VALUE_SIZE];
+    bool dirty;
+  } field_t;
+
+  void set_raw(const char *key, const char *value);
+
+  field_t m_fields[FIELDS];
+  size_t m_count = 0;
+};
+
+extern WebState web_state;
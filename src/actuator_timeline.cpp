@@ -0,0 +1,47 @@
+#include "actuator_timeline.h"
+#include <string.h>
+
+#include "hal.h"
+
+ActuatorTimeline actuator_timeline;
+
+bool ActuatorTimeline::start(const timeline_step_t *steps, size_t count, uint32_t now) {
+  if (count > TIMELINE_MAX_STEPS) {
+    return false;
+  }
+  if (active()) {
+    m_cancelled++;
+  }
+  memcpy(m_steps, steps, count * sizeof(timeline_step_t));
+  m_count = count;
+  m_next = 0;
+  m_due = count ? now + steps[0].delay_ms : now;
+  m_generation = m_cancel.load();
+  poll(now);
+  return true;
+}
+
+void ActuatorTimeline::poll(uint32_t now) {
+  uint32_t cancel = m_cancel.load();
+  if (m_generation != cancel) {
+    m_generation = cancel;
+    if (active()) {
+      m_cancelled++;
+    }
+    m_count = 0;
+    m_next = 0;
+    return;
+  }
+  while (m_next < m_count && (int32_t)(now - m_due) >= 0) {
+    const timeline_step_t &step = m_steps[m_next++];
+    if (step.action >= 0) {
+      hal_actuator(step.action, step.lane);
+    }
+    if (step.publish) {
+      hal_mqtt_publish(step.publish);
+    }
+    if (m_next < m_count) {
+      m_due += m_steps[m_next].delay_ms;
+    }
+  }
+}
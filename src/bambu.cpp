@@ -0,0 +1,302 @@
+#include "bambu.h"
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "actuator_timeline.h"
+#include "hal.h"
+#include "json_arena.h"
+#include "metrics.h"
+#include "swap_profiler.h"
+#include "web_state.h"
+
+// 拓竹指令
+// 执行 Unload 指令，打印机将开始自动加热热端，并切断线材。
+const char* bambu_unload = "{\
+  \"print\": {\
+    \"command\": \"ams_change_filament\",\
+    \"curr_temp\": 210,\
+    \"sequence_id\": \"zp-ams-1\",\
+    \"tar_temp\": 210,\
+    \"target\": 255\
+  }\
+}";
+
+const char* bambu_load = "{\
+  \"print\": {\
+    \"command\": \"ams_change_filament\",\
+    \"curr_temp\": 210,\
+    \"sequence_id\": \"zp-ams-1\",\
+    \"tar_temp\": 210,\
+    \"target\": 254\
+  }\
+}";
+
+const char* bambu_done = "{\
+  \"print\": {\
+    \"command\": \"ams_control\",\
+    \"param\": \"done\",\
+    \"sequence_id\":\"zp-ams-1\"\
+  },\
+  \"user_id\": \"mqttx_c59bbf21\"\
+}";
+
+// 重试|继续打印
+const char* bambu_resume = "{\
+  \"print\": {\
+    \"command\": \"resume\",\
+    \"sequence_id\": \"zp-ams-1\"\
+  },\
+  \"user_id\": \"mqttx_c59bbf21\"\
+}";
+
+const char* bambu_gcode_m109 = "{\
+  \"print\": {\
+    \"command\": \"gcode_line\",\
+    \"sequence_id\": \"zp-ams-1\",\
+    \"param\": \"M109 S\"220\"\
+  },\
+  \"user_id\": \"mqttx_c59bbf21\"\
+}";
+
+const char* bambu_pushall = "{\
+  \"pushing\": {\
+    \"sequence_id\": \"zp-ams-1\",\
+    \"command\": \"pushall\"\
+  }\
+}";
+
+// 打印机通过 mqtt 发送来的信息
+// -1 表示未知
+int print_error = -1;
+int ams_status = -1;
+// 进料开关状态，0 无料，1 有料
+int hw_switch_state = -1;
+// 黑客入侵[打印进度]，用[mc_percent - 110]表示接下来期望换用的挤出机id
+int mc_percent = -1;
+char gcode_state[16];
+
+// ZP AMS 状态:
+// 自动换料的状态，0 空闲，1 忙碌
+int zp_state = 0;
+// 有待退料管道
+int previous_extruder = 0;
+// 有待进料管道
+int next_extruder = 0;
+
+uint32_t bambu_prestage_ms = 0;
+uint8_t parked_lanes = 0;
+bambu_swap_stats_t bambu_swap_stats;
+
+// 正在预送料的通道，以及停止步骤预定执行的时间
+static int s_prestage_lane = -1;
+static uint32_t s_prestage_until = 0;
+// 正在进行的进料
+static bool s_loading = false;
+static bool s_load_prestaged = false;
+static uint32_t s_load_start = 0;
+
+bool bambu_prestaging(int lane, uint32_t now) {
+  return s_prestage_lane >= 0 && lane == s_prestage_lane && (int32_t)(s_prestage_until - now) > 0;
+}
+
+static uint8_t s_arena_buffer[BAMBU_JSON_ARENA_SIZE];
+JsonArena bambu_json_arena(s_arena_buffer, sizeof(s_arena_buffer));
+
+// 只保留下面这些字段，其余的在解析时直接跳过
+static JsonDocument& report_filter() {
+  static JsonDocument filter;     // 第一次调用时分配，之后不再变化
+  if (filter.isNull()) {
+    JsonObject print = filter["print"].to<JsonObject>();
+    print["sequence_id"] = true;
+    print["hw_switch_state"] = true;
+    print["gcode_state"] = true;
+    print["mc_percent"] = true;
+    print["ams_status"] = true;
+    print["print_error"] = true;
+  }
+  return filter;
+}
+
+// 立即执行的电机动作，同时取代还没执行完的序列；被取代的预送料先停下
+static void actuate(uint8_t action, uint8_t lane) {
+  uint32_t now = hal_millis();
+  timeline_step_t steps[2];
+  size_t count = 0;
+  if (bambu_prestaging(s_prestage_lane, now) && s_prestage_lane != lane) {
+    steps[count++] = {0, ACTUATOR_STOP, (uint8_t)s_prestage_lane, nullptr};
+  }
+  s_prestage_lane = -1;
+  steps[count++] = {0, (int8_t)action, lane, nullptr};
+  actuator_timeline.start(steps, count, now);
+}
+
+// 打印中提前把下一个通道的耗材送到停靠点，换料时只需进最后一小段
+static void prestage(int lane) {
+  if (bambu_prestage_ms == 0 || lane < 0 || lane >= 4 || lane == previous_extruder || (parked_lanes & (1 << lane))) {
+    return;
+  }
+  if (actuator_timeline.active()) {
+    return;
+  }
+  uint32_t now = hal_millis();
+  timeline_step_t steps[] = {
+    {0, ACTUATOR_FORWARD, (uint8_t)lane, nullptr},
+    {bambu_prestage_ms, ACTUATOR_STOP, (uint8_t)lane, nullptr},
+  };
+  parked_lanes |= 1 << lane;
+  s_prestage_lane = lane;
+  s_prestage_until = now + bambu_prestage_ms;
+  hal_log("prestage extruder %d for %u ms\n", lane, (unsigned)bambu_prestage_ms);
+  actuator_timeline.start(steps, 2, now);
+}
+
+DeserializationError bambu_parse_report(JsonDocument &doc, const uint8_t *payload, size_t length) {
+  return deserializeJson(doc, payload, length, DeserializationOption::Filter(report_filter()));
+}
+
+void bambu_on_message(const uint8_t *payload, size_t length) {
+  metrics.mqtt_messages++;
+  metrics.mqtt_bytes += length;
+  // 文档从 bambu_json_arena 分配，函数返回前析构
+  bambu_json_arena.reset();
+  // https://arduinojson.org/v7/api/jsondocument/
+  JsonDocument data(&bambu_json_arena);
+  DeserializationError error = bambu_parse_report(data, payload, length);
+  if (error) {
+    metrics.mqtt_parse_errors++;
+    hal_log("bambu report: %s\n", error.c_str());
+    return;
+  }
+  if (!data["print"].is<JsonObject>()) {
+    // 收到未知信息，直接不理睬
+    return;
+  }
+
+  bool updated = false;
+  const char* sequence_id = data["print"]["sequence_id"] | "";
+  if (data["print"]["hw_switch_state"].is<int>()) {
+    hw_switch_state = data["print"]["hw_switch_state"];
+    web_state.set("hw_switch_state", hw_switch_state);
+    updated = true;
+  }
+  if (data["print"]["gcode_state"].is<const char*>()) {
+    snprintf(gcode_state, sizeof(gcode_state), "%s", data["print"]["gcode_state"].as<const char*>());
+    web_state.set("gcode_state", gcode_state);
+    updated = true;
+  }
+  if (data["print"]["mc_percent"].is<int>()) {
+    mc_percent = data["print"]["mc_percent"];
+    web_state.set("mc_percent", mc_percent);
+    updated = true;
+  }
+  if (strcmp(gcode_state, "PAUSE") != 0) {
+    // 如果打印机不空闲，那么我必空闲
+    zp_state = 0;
+    if (strcmp(gcode_state, "RUNNING") == 0 && mc_percent >= BAMBU_PRESTAGE_PERCENT) {
+      prestage(mc_percent - BAMBU_PRESTAGE_PERCENT);
+    }
+  } else if (mc_percent > 100 && mc_percent < BAMBU_PRESTAGE_PERCENT && zp_state == 0) {
+    zp_state = 1;
+    // 打印机处于暂停状态，且收到黑客请求，且处于空闲状态
+    next_extruder = mc_percent - BAMBU_SWAP_PERCENT;
+    swap_profiler.begin(previous_extruder, next_extruder, hal_millis());
+    if (hw_switch_state == -1) {
+      // 当前状态未知？？？error error error
+      return;
+    }
+    if (hw_switch_state == 0) {
+      // 无料，直接进料
+      hal_mqtt_publish(bambu_load);
+    } else if (next_extruder != previous_extruder) {
+      // 换料，先退料
+      hal_mqtt_publish(bambu_unload);
+    } else {
+      // 直接点完成吧
+      hal_mqtt_publish(bambu_resume);
+    }
+  }
+  if (data["print"]["ams_status"].is<int>()) {
+    ams_status = data["print"]["ams_status"];
+    web_state.set("ams_status", ams_status);
+    updated = true;
+    hal_log("bambu sequence_id: \"%s\" ams_status: %d\n", sequence_id, ams_status);
+    swap_profiler.status(ams_status, previous_extruder, next_extruder, hal_millis());
+
+    if (ams_status == 260) {
+      // 请回抽
+      actuate(ACTUATOR_BACKWARD, previous_extruder);
+    } if (ams_status == 261) {
+      // 请推入
+      if (!s_loading) {
+        s_loading = true;
+        s_load_prestaged = next_extruder >= 0 && (parked_lanes & (1 << next_extruder));
+        s_load_start = hal_millis();
+      }
+      actuate(ACTUATOR_FORWARD, next_extruder);
+    } else if (ams_status == 262) {
+      // 推入完成
+      actuate(ACTUATOR_STOP, LANE_ALL);
+      if (s_loading) {
+        s_loading = false;
+        uint32_t load_ms = hal_millis() - s_load_start;
+        bambu_swap_stats.loads[s_load_prestaged]++;
+        bambu_swap_stats.load_ms[s_load_prestaged] += load_ms;
+        bambu_swap_stats.last_load_ms = load_ms;
+        bambu_swap_stats.last_prestaged = s_load_prestaged;
+        hal_log("load extruder %d: %u ms%s\n", next_extruder, (unsigned)load_ms, s_load_prestaged ? " (prestaged)" : "");
+      }
+    } else if (ams_status == 768) {
+      // 完成换料
+      if (next_extruder >= 0) {
+        parked_lanes &= ~(1 << next_extruder);
+      }
+      previous_extruder = next_extruder;
+      if (zp_state == 1) {
+        hal_mqtt_publish(bambu_resume);
+      }
+    } else if (ams_status == 0 && (zp_state == 1 || !bambu_prestaging(s_prestage_lane, hal_millis()))) {
+      // 完成退料，但还要继续拔出一段，然后停止并开始进料；退出来的耗材停在汇合处之前。
+      // 打印中报告的空闲不打断预送料
+      if (zp_state == 1 && previous_extruder >= 0) {
+        parked_lanes |= 1 << previous_extruder;
+      }
+      s_prestage_lane = -1;
+      timeline_step_t step = {1000, ACTUATOR_STOP, LANE_ALL, zp_state == 1 ? bambu_load : nullptr};
+      actuator_timeline.start(&step, 1, hal_millis());
+    }
+    /*
+    0    空闲 or 完成退料？
+    258  加热中
+    259  裁剪耗材中
+    260  请回抽
+    261  请推入
+    262  检测到进料，hw_switch_state = 1
+    263  清理
+    768  完成换料 or 完成进料
+    1280 完成
+    */
+  }
+  
+  if (data["print"]["print_error"].is<int>()) {
+    print_error = data["print"]["print_error"];
+    web_state.set("print_error", print_error);
+    updated = true;
+    hal_log("bambu sequence_id: \"%s\" print_error: %d\n", sequence_id, print_error);
+    if (print_error != 0) {
+      swap_profiler.error(hal_millis());
+    }
+    // 318750726 0b1001011111111 11000000 00000110 请推入耗材？
+    // 318734342 0b1001011111111 11001110 00100110 没检测到进料？
+    // 318750723 0b1001011111111 11000000 00000011 请拔出耗材？
+    // 318734339 0b1001011111111 10000000 00000011 拔出耗材
+    // 318734343 0b1001011111111 10000000 00000111 是否完成换料？
+    if (print_error == 318734343) {
+      // 弹窗询问：“是否完成换料？”，我们点击完成
+      hal_mqtt_publish(bambu_done);
+    }
+  }
+  if (updated) {
+    web_state.set("sequence_id", sequence_id);
+  }
+}
@@ -0,0 +1,44 @@
+#include "bambu_frame.h"
+#include "crc.h"
+
+bool bambu_check_head(const bambu_data_t *data) {
+  if (data->type & 0x80) {
+    return data->body_80.rv == crc8((const uint8_t*)data, 3);
+  } else {
+    return data->body_00.rv == crc8((const uint8_t*)data, 6);
+  }
+}
+
+bool bambu_check_body(const bambu_data_t *data) {
+  size_t size = bambu_size(data);
+  uint16_t rv = crc16((const uint8_t*)data, size - 2);
+  return ((uint8_t*)data)[size - 2] == (rv & 0xFF) && ((uint8_t*)data)[size - 1] == (rv >> 8);
+}
+
+bool bambu_check(const bambu_data_t *data) {
+  return bambu_check_head(data) && bambu_check_body(data);
+}
+
+size_t bambu_seal(bambu_data_t *data) {
+  size_t size;
+  if (data->type & 0x80) {
+    data->body_80.rv = crc8((const uint8_t*)data, 3);
+    size = data->body_80.size;
+  } else {
+    data->body_00.rv = crc8((const uint8_t*)data, 6);
+    size = data->body_00.size;
+  }
+  uint16_t rv = crc16((const uint8_t*)data, size - 2);
+  ((uint8_t*)data)[size - 2] = rv & 0xFF;
+  ((uint8_t*)data)[size - 1] = rv >> 8;
+  return size;
+}
+
+void bambu_to_hex(const uint8_t *data, size_t size, char *hex) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < size; i++) {
+    hex[i * 2] = digits[data[i] >> 4];
+    hex[i * 2 + 1] = digits[data[i] & 0x0f];
+  }
+  hex[size * 2] = 0;
+}
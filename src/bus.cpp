@@ -0,0 +1,182 @@
+#include "bus.h"
+#include "hal.h"
+#include <Arduino.h>
+#include <driver/uart.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#define RS485_UART UART_NUM_1
+
+FrameParser bus_parser;
+uint32_t bus_uart_overflows = 0;
+uint32_t bus_uart_errors = 0;
+uint32_t bus_dropped_frames = 0;
+uint32_t bus_turnaround_us = 0;
+uint32_t bus_turnaround_max_us = 0;
+uint32_t bus_tx_timeouts = 0;
+uint32_t bus_collisions = 0;
+
+static bus_handler_t s_handler = nullptr;
+static QueueHandle_t s_uart_queue = nullptr;
+// 每个通道最新请求的动作，BUS_NO_ACTION 表示没有
+#define BUS_NO_ACTION 0xff
+static uint8_t s_actuators[BUS_LANES] = {BUS_NO_ACTION, BUS_NO_ACTION, BUS_NO_ACTION, BUS_NO_ACTION};
+static portMUX_TYPE s_actuator_mux = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t s_frame_queue = nullptr;
+// 第一次调用 bus_write 时的 hal_cycles()，还没有等到发完
+static uint32_t s_tx_cycles = 0;
+static size_t s_tx_bytes = 0;
+static bool s_tx_pending = false;
+
+void bus_write(const uint8_t *data, size_t size) {
+  if (!s_tx_pending) {
+    s_tx_cycles = hal_cycles();
+    s_tx_bytes = 0;
+    s_tx_pending = true;
+  }
+  s_tx_bytes += size;
+  uart_write_bytes(RS485_UART, (const char*)data, size);
+}
+
+// 处理完一次接收到的帧之后等应答发完，这样应答耗时的统计不包括发送本身。
+// 打印机要等应答结束才发下一帧，这段时间总线任务本来也没有别的事做。
+static void bus_tx_done() {
+  if (!s_tx_pending) {
+    return;
+  }
+  s_tx_pending = false;
+  if (uart_wait_tx_done(RS485_UART, pdMS_TO_TICKS(BUS_TX_TIMEOUT_MS)) != ESP_OK) {
+    bus_tx_timeouts++;
+    return;
+  }
+  uint32_t elapsed_us = (hal_cycles() - s_tx_cycles) / hal_cycles_per_us();
+  // 同一次处理中的几个应答是连续发出的
+  uint32_t wire_us = (uint64_t)s_tx_bytes * RS485_BITS_PER_BYTE * 1000000 / RS485_BAUD;
+  bus_turnaround_us = elapsed_us > wire_us ? elapsed_us - wire_us : 0;
+  if (bus_turnaround_us > bus_turnaround_max_us) {
+    bus_turnaround_max_us = bus_turnaround_us;
+  }
+  bool collision = false;
+  if (uart_get_collision_flag(RS485_UART, &collision) == ESP_OK && collision) {
+    bus_collisions++;
+  }
+}
+
+void bus_post_actuator(uint8_t action, uint8_t lane) {
+  if (lane >= BUS_LANES) {
+    return;
+  }
+  portENTER_CRITICAL(&s_actuator_mux);
+  s_actuators[lane] = action;
+  portEXIT_CRITICAL(&s_actuator_mux);
+}
+
+void bus_post_frame(const bambu_data_t *data) {
+  static bus_frame_t frame;
+  frame.size = bambu_size(data);
+  memcpy(frame.data, data, frame.size);
+  if (xQueueSend(s_frame_queue, &frame, 0) != pdTRUE) {
+    bus_dropped_frames++;
+  }
+}
+
+bool bus_receive_actuator(bus_actuator_t *actuator) {
+  // 轮流从各通道取，免得一个通道的频繁请求挡住其它通道
+  static uint8_t s_next = 0;
+  bool found = false;
+  portENTER_CRITICAL(&s_actuator_mux);
+  for (uint8_t i = 0; i < BUS_LANES && !found; i++) {
+    uint8_t lane = (s_next + i) % BUS_LANES;
+    if (s_actuators[lane] != BUS_NO_ACTION) {
+      actuator->action = s_actuators[lane];
+      actuator->lane = lane;
+      s_actuators[lane] = BUS_NO_ACTION;
+      s_next = lane + 1;
+      found = true;
+    }
+  }
+  portEXIT_CRITICAL(&s_actuator_mux);
+  return found;
+}
+
+bool bus_receive_frame(bus_frame_t *frame) {
+  return xQueueReceive(s_frame_queue, frame, 0) == pdTRUE;
+}
+
+static void bus_read() {
+  // 接收超时事件在最后一个字节之后约一个字符时间产生
+  uint32_t rx_cycles = hal_cycles();
+  size_t n = 0;
+  uart_get_buffered_data_len(RS485_UART, &n);
+  while (n > 0 && bus_parser.write_space() > 0) {
+    size_t space = bus_parser.write_space();
+    int rv = uart_read_bytes(RS485_UART, bus_parser.write_ptr(), n < space ? n : space, 0);
+    if (rv <= 0) {
+      break;
+    }
+    bus_parser.commit(rv);
+    n -= rv;
+    while (const bambu_data_t *data = bus_parser.next()) {
+      s_handler(data, rx_cycles);
+    }
+  }
+  bus_tx_done();
+}
+
+static void bus_task(void *) {
+  uart_event_t event;
+  while (true) {
+    if (xQueueReceive(s_uart_queue, &event, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    switch (event.type) {
+      case UART_DATA:
+        bus_read();
+        break;
+      case UART_FIFO_OVF:
+      case UART_BUFFER_FULL:
+        // 数据已经不完整，丢掉重新同步
+        bus_uart_overflows++;
+        uart_flush_input(RS485_UART);
+        xQueueReset(s_uart_queue);
+        break;
+      case UART_PARITY_ERR:
+      case UART_FRAME_ERR:
+        // 坏字节留在数据中，由帧的校验码剔除
+        bus_uart_errors++;
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void bus_setup(bus_handler_t handler) {
+  s_handler = handler;
+  s_frame_queue = xQueueCreate(BUS_FRAME_QUEUE_SIZE, sizeof(bus_frame_t));
+
+  uart_config_t config = {};
+  config.baud_rate = RS485_BAUD;
+  config.data_bits = UART_DATA_8_BITS;
+  config.parity = UART_PARITY_EVEN;
+  config.stop_bits = UART_STOP_BITS_1;
+  config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  config.source_clk = UART_SCLK_APB;
+  if (uart_driver_install(RS485_UART, BUS_RX_BUFFER_SIZE, 0, 16, &s_uart_queue, 0) != ESP_OK) {
+    Serial.println("Failed to install RS485 driver");
+    return;
+  }
+  uart_param_config(RS485_UART, &config);
+  if (uart_set_pin(RS485_UART, RS485_TX_PIN, RS485_RX_PIN, RS485_RTS_PIN, UART_PIN_NO_CHANGE) != ESP_OK) {
+    Serial.println("Failed to set RS485 pins");
+  }
+  if (uart_set_mode(RS485_UART, UART_MODE_RS485_HALF_DUPLEX) != ESP_OK) {
+    Serial.println("Failed to set RS485 mode");
+  }
+  // 总线空闲 BUS_RX_TIMEOUT_SYMBOLS 个字符的时间就产生 UART_DATA 事件，即一帧结束
+  uart_set_rx_timeout(RS485_UART, BUS_RX_TIMEOUT_SYMBOLS);
+
+  xTaskCreatePinnedToCore(bus_task, "rs485", BUS_TASK_STACK_SIZE, nullptr,
+                          BUS_TASK_PRIORITY, nullptr, BUS_TASK_CORE);
+}
@@ -0,0 +1,341 @@
+#include "cloud.h"
+#include <ArduinoJson.h>
+#include <HTTPClient.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <arduino_base64.hpp>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/ringbuf.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "bambu.h"
+#include "hal.h"
+#include "metrics.h"
+
+#define BAMBU_MQTT_ID "mqttx_c59bbf21"
+#define BAMBU_MQTT_PORT 8883
+#define BAMBU_WAN_BROKER "cn.mqtt.bambulab.com"
+#define BAMBU_LOGIN_URL "https://api.bambulab.cn/v1/user-service/user/login"
+
+// 以下对象只在 cloud 任务中使用
+static WiFiClientSecure s_wifi_client;
+static PubSubClient s_client(s_wifi_client);
+static cloud_config_t s_config;
+static uint32_t s_retry_at = 0;
+
+// cloud_configure 写入，cloud 任务在 s_generation 变化时取走；登录结果反方向传递
+static SemaphoreHandle_t s_config_mutex = nullptr;
+static cloud_config_t s_pending_config;
+static uint32_t s_generation = 0;
+static bool s_login_ready = false;
+
+static QueueHandle_t s_publish_queue = nullptr;
+static RingbufHandle_t s_message_buffer = nullptr;
+
+// 只有 cloud 任务写入
+static portMUX_TYPE s_health_mux = portMUX_INITIALIZER_UNLOCKED;
+static cloud_health_t s_health = {};
+
+static bool same_config(const cloud_config_t &a, const cloud_config_t &b) {
+  return a.mode == b.mode && a.broker == b.broker && a.mqtt_password == b.mqtt_password &&
+         a.topic_subscribe == b.topic_subscribe && a.topic_publish == b.topic_publish &&
+         a.phone_number == b.phone_number && a.password == b.password &&
+         a.username == b.username && a.access_token == b.access_token;
+}
+
+static void set_state(uint8_t state) {
+  portENTER_CRITICAL(&s_health_mux);
+  s_health.state = state;
+  if (state == CLOUD_CONNECTED) {
+    s_health.connected_at = millis();
+    s_health.consecutive_failures = 0;
+    s_health.backoff_ms = 0;
+  }
+  portEXIT_CRITICAL(&s_health_mux);
+}
+
+static void finish_attempt(uint32_t begin) {
+  uint32_t ms = millis() - begin;
+  portENTER_CRITICAL(&s_health_mux);
+  s_health.last_attempt_ms = ms;
+  if (ms > s_health.max_attempt_ms) {
+    s_health.max_attempt_ms = ms;
+  }
+  portEXIT_CRITICAL(&s_health_mux);
+}
+
+// 第 n 次连续失败后等待 [d/2, d]，d = min(MAX, MIN * 2^(n-1))；
+// 随机抖动让断电恢复后的多台设备不会同时重连
+static uint32_t backoff_ms(uint32_t failures) {
+  uint32_t d = CLOUD_BACKOFF_MAX_MS;
+  if (failures > 0 && failures <= 16 && ((uint32_t)CLOUD_BACKOFF_MIN_MS << (failures - 1)) < d) {
+    d = (uint32_t)CLOUD_BACKOFF_MIN_MS << (failures - 1);
+  }
+  return d / 2 + esp_random() % (d / 2 + 1);
+}
+
+static void fail(int32_t error, bool retry) {
+  portENTER_CRITICAL(&s_health_mux);
+  s_health.last_error = error;
+  s_health.failures++;
+  s_health.consecutive_failures++;
+  s_health.backoff_ms = retry ? backoff_ms(s_health.consecutive_failures) : 0;
+  s_health.state = retry ? CLOUD_BACKOFF : CLOUD_STOPPED;
+  s_retry_at = millis() + s_health.backoff_ms;
+  portEXIT_CRITICAL(&s_health_mux);
+}
+
+// 把新的用户名与 token 交给主循环写回配置
+static void post_login(const String &username, const String &access_token) {
+  s_config.username = username;
+  s_config.access_token = access_token;
+  xSemaphoreTake(s_config_mutex, portMAX_DELAY);
+  s_pending_config.username = username;
+  s_pending_config.access_token = access_token;
+  s_login_ready = true;
+  xSemaphoreGive(s_config_mutex);
+}
+
+static void on_message(char *topic, byte *payload, unsigned int length) {
+  if (length == 0) {
+    return;
+  }
+  if (xRingbufferSend(s_message_buffer, payload, length, 0) != pdTRUE) {
+    portENTER_CRITICAL(&s_health_mux);
+    s_health.messages_dropped++;
+    portEXIT_CRITICAL(&s_health_mux);
+  }
+}
+
+static void connect(const char *broker, const char *user, const char *password) {
+  set_state(CLOUD_CONNECTING);
+  s_client.setServer(broker, BAMBU_MQTT_PORT);
+  metrics.mqtt_connects++;
+  uint32_t begin = millis();
+  bool connected = s_client.connect(BAMBU_MQTT_ID, user, password);
+  finish_attempt(begin);
+  if (connected) {
+    hal_log("Connecting to bambu .. connected!\n");
+    s_client.subscribe(s_config.topic_subscribe.c_str());
+    s_client.publish(s_config.topic_publish.c_str(), bambu_pushall);
+    set_state(CLOUD_CONNECTED);
+    return;
+  }
+  int state = s_client.state();
+  metrics.mqtt_connect_failures++;
+  hal_log("The bambu connection(%s) failed! state: %d\n", s_config.mode.c_str(), state);
+  bool rejected = state == MQTT_CONNECT_BAD_CREDENTIALS || state == MQTT_CONNECT_UNAUTHORIZED;
+  if (rejected && s_config.mode == "WAN") {
+    // token 过期，重新登录
+    post_login("", "");
+    fail(state, true);
+  } else {
+    // 访问码错误时重试也没有用
+    fail(state, !rejected);
+  }
+}
+
+static void login() {
+  set_state(CLOUD_LOGIN);
+  HTTPClient http;
+  http.setConnectTimeout(CLOUD_TIMEOUT_MS);
+  http.setTimeout(CLOUD_TIMEOUT_MS);
+  http.begin(BAMBU_LOGIN_URL);
+  http.addHeader("Content-Type", "application/json");
+  JsonDocument data;
+  data["account"] = s_config.phone_number;
+  data["password"] = s_config.password;
+  char buffer[256];
+  serializeJson(data, buffer, sizeof(buffer));
+  hal_log("[HTTP] POST %s\n", BAMBU_LOGIN_URL);
+  uint32_t begin = millis();
+  int code = http.POST(buffer);
+  String body = code == HTTP_CODE_OK ? http.getString() : String();
+  http.end();
+  finish_attempt(begin);
+  portENTER_CRITICAL(&s_health_mux);
+  s_health.logins++;
+  portEXIT_CRITICAL(&s_health_mux);
+  if (code != HTTP_CODE_OK) {
+    hal_log("[HTTP] POST... code: %d\n", code);
+    // 4xx 是账号或密码错误，其余（网络错误、5xx）稍后重试
+    fail(code, !(code >= 400 && code < 500));
+    return;
+  }
+  deserializeJson(data, body);
+  String access_token = data["accessToken"] | "";
+  // token 是 JWT，第二段是 base64 编码的 JSON，其中有 username
+  int first = access_token.indexOf('.');
+  int second = access_token.indexOf('.', first + 1);
+  if (first < 0 || second < 0) {
+    fail(code, true);
+    return;
+  }
+  String encoded = access_token.substring(first + 1, second);
+  uint8_t payload[base64::decodeLength(encoded.c_str())];
+  base64::decode(encoded.c_str(), payload);
+  deserializeJson(data, payload, sizeof(payload));
+  String username = data["username"] | "";
+  hal_log("username: %s\n", username.c_str());
+  post_login(username, access_token);
+  // 下一步立即连接
+  set_state(CLOUD_IDLE);
+}
+
+static void step() {
+  switch (s_health.state) {
+    case CLOUD_CONNECTED:
+      if (s_client.connected()) {
+        s_client.loop();
+        return;
+      }
+      portENTER_CRITICAL(&s_health_mux);
+      s_health.disconnects++;
+      portEXIT_CRITICAL(&s_health_mux);
+      xQueueReset(s_publish_queue);
+      fail(s_client.state(), true);
+      return;
+    case CLOUD_STOPPED:
+      return;
+    case CLOUD_BACKOFF:
+      if ((int32_t)(millis() - s_retry_at) < 0) {
+        return;
+      }
+      set_state(CLOUD_IDLE);
+      break;
+    default:
+      break;
+  }
+  if (WiFi.status() != WL_CONNECTED) {
+    return;
+  }
+  if (s_config.mode == "LAN") {
+    connect(s_config.broker.c_str(), "bblp", s_config.mqtt_password.c_str());
+  } else if (s_config.mode == "WAN") {
+    if (!s_config.username.isEmpty() && !s_config.access_token.isEmpty()) {
+      connect(BAMBU_WAN_BROKER, s_config.username.c_str(), s_config.access_token.c_str());
+    } else if (!s_config.phone_number.isEmpty() && !s_config.password.isEmpty()) {
+      login();
+    }
+  }
+}
+
+static void cloud_task(void *) {
+  uint32_t generation = 0;
+  while (true) {
+    xSemaphoreTake(s_config_mutex, portMAX_DELAY);
+    bool changed = generation != s_generation;
+    if (changed) {
+      generation = s_generation;
+      s_config = s_pending_config;
+    }
+    xSemaphoreGive(s_config_mutex);
+    if (changed) {
+      // 配置变了：断开，清零退避，立即按新的配置连接
+      if (s_client.connected()) {
+        s_client.disconnect();
+      }
+      xQueueReset(s_publish_queue);
+      portENTER_CRITICAL(&s_health_mux);
+      s_health.consecutive_failures = 0;
+      s_health.backoff_ms = 0;
+      portEXIT_CRITICAL(&s_health_mux);
+      set_state(CLOUD_IDLE);
+    }
+
+    step();
+
+    if (s_health.state == CLOUD_CONNECTED) {
+      // 等待要发布的消息，同时作为轮询间隔
+      const char *payload;
+      while (xQueueReceive(s_publish_queue, &payload, pdMS_TO_TICKS(10)) == pdTRUE) {
+        s_client.publish(s_config.topic_publish.c_str(), payload);
+      }
+    } else {
+      vTaskDelay(pdMS_TO_TICKS(100));
+    }
+  }
+}
+
+void cloud_setup() {
+  s_config_mutex = xSemaphoreCreateMutex();
+  s_publish_queue = xQueueCreate(CLOUD_PUBLISH_QUEUE_SIZE, sizeof(const char*));
+  s_message_buffer = xRingbufferCreate(CLOUD_MESSAGE_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+  // https://pubsubclient.knolleary.net/
+  s_wifi_client.setInsecure();
+  s_wifi_client.setHandshakeTimeout(CLOUD_TIMEOUT_MS / 1000);
+  s_client.setSocketTimeout(CLOUD_TIMEOUT_MS / 1000);
+  s_client.setCallback(on_message);
+  s_client.setBufferSize(4096);   // 其默认值 256 太小啦
+  xTaskCreatePinnedToCore(cloud_task, "cloud", CLOUD_TASK_STACK_SIZE, nullptr,
+                          CLOUD_TASK_PRIORITY, nullptr, CLOUD_TASK_CORE);
+}
+
+void cloud_configure(const cloud_config_t &config) {
+  if (s_config_mutex == nullptr) {
+    return;
+  }
+  xSemaphoreTake(s_config_mutex, portMAX_DELAY);
+  if (!same_config(config, s_pending_config)) {
+    s_pending_config = config;
+    s_generation++;
+  }
+  xSemaphoreGive(s_config_mutex);
+}
+
+bool cloud_connected() {
+  return s_health.state == CLOUD_CONNECTED;
+}
+
+bool cloud_publish(const char *payload) {
+  if (!cloud_connected()) {
+    return false;
+  }
+  return xQueueSend(s_publish_queue, &payload, 0) == pdTRUE;
+}
+
+void cloud_health(cloud_health_t *health) {
+  portENTER_CRITICAL(&s_health_mux);
+  *health = s_health;
+  portEXIT_CRITICAL(&s_health_mux);
+}
+
+const char* cloud_state_name(uint8_t state) {
+  static const char* const names[] = {"idle", "login", "connecting", "connected", "backoff", "stopped"};
+  return state < sizeof(names) / sizeof(names[0]) ? names[state] : "unknown";
+}
+
+void cloud_dispatch() {
+  if (s_message_buffer == nullptr) {
+    return;
+  }
+  // 每次最多处理几条，不让主循环在这里停留太久
+  for (int i = 0; i < 4; i++) {
+    size_t size = 0;
+    void *item = xRingbufferReceive(s_message_buffer, &size, 0);
+    if (item == nullptr) {
+      break;
+    }
+    bambu_on_message((const uint8_t*)item, size);
+    vRingbufferReturnItem(s_message_buffer, item);
+  }
+}
+
+bool cloud_take_login(String *username, String *access_token) {
+  if (s_config_mutex == nullptr) {
+    return false;
+  }
+  xSemaphoreTake(s_config_mutex, portMAX_DELAY);
+  bool ready = s_login_ready;
+  if (ready) {
+    *username = s_pending_config.username;
+    *access_token = s_pending_config.access_token;
+    s_login_ready = false;
+  }
+  xSemaphoreGive(s_config_mutex);
+  return ready;
+}
@@ -0,0 +1,311 @@
+#include "config.h"
+#include <LittleFS.h>
+
+#include "latency.h"
+
+Config app_config;
+
+// 没有配置 lanes、selectors 时沿用原来的接线：一个舵机在两个通道间切换，各有一个电机
+static const lane_config_t LANES_LEGACY[] = {
+  {{12, 13}, 0, -1, -1, {-1, -1}},
+  {{27, 26}, 0, 1, -1, {-1, -1}},
+};
+static const selector_config_t SELECTOR_LEGACY = {14, 90};
+
+// config.json 中的调速参数
+typedef struct {
+  const char *key;
+  uint32_t motor_profile_t::*value;
+} motor_key_t;
+
+static const motor_key_t s_motor_keys[] = {
+  {"motor_pwm_hz", &motor_profile_t::pwm_hz},
+  {"motor_accel_ms", &motor_profile_t::accel_ms},
+  {"motor_decel_ms", &motor_profile_t::decel_ms},
+  {"motor_feed_speed", &motor_profile_t::feed_speed},
+  {"motor_feed_fast_ms", &motor_profile_t::feed_fast_ms},
+  {"motor_approach_speed", &motor_profile_t::approach_speed},
+  {"motor_retract_speed", &motor_profile_t::retract_speed},
+};
+
+template <typename T>
+static T clamp(T value, T low, T high) {
+  return value < low ? low : value > high ? high : value;
+}
+
+// 引脚号超出 ESP32 的范围时视为没有接
+static int8_t pin_of(JsonVariantConst value) {
+  int pin = value | -1;
+  return pin >= 0 && pin < 40 ? pin : -1;
+}
+
+static uint32_t hash_of(const String &text) {
+  uint32_t hash = 2166136261u;    // FNV-1a
+  for (size_t i = 0; i < text.length(); i++) {
+    hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+  }
+  return hash;
+}
+
+void Config::setup() {
+  m_mutex = xSemaphoreCreateRecursiveMutex();
+  JsonDocument doc;
+  bool ok = read(CONFIG_PATH, doc);
+  if (LittleFS.exists(CONFIG_TMP_PATH)) {
+    // 写完临时文件、改名之前断电：正式文件坏了时用临时文件，否则临时文件可能没写完，丢弃
+    JsonDocument tmp;
+    if (!ok && read(CONFIG_TMP_PATH, tmp)) {
+      Serial.println("Config recovered from " CONFIG_TMP_PATH);
+      LittleFS.rename(CONFIG_TMP_PATH, CONFIG_PATH);
+      doc = tmp;
+      ok = true;
+    } else {
+      LittleFS.remove(CONFIG_TMP_PATH);
+    }
+  }
+  if (!ok && LittleFS.exists(CONFIG_PATH)) {
+    Serial.println("Config " CONFIG_PATH " is corrupt, using defaults");
+  }
+  load(doc.as<JsonVariantConst>());
+  validate();
+  // 与读到的内容相同时不必重写
+  JsonDocument canonical;
+  to_json(canonical);
+  String text;
+  serializeJson(canonical, text);
+  m_saved_hash = hash_of(text);
+}
+
+bool Config::read(const char *path, JsonDocument &doc) {
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return false;
+  }
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  return !error && doc.is<JsonObject>();
+}
+
+void Config::load(JsonVariantConst data) {
+  app_config_t &c = m_values;
+  c.wifi_ssid = data["WiFi_ssid"] | "";
+  c.wifi_passphrase = data["WiFi_passphrase"] | "";
+  c.mode = data["mode"] | "";
+  c.broker = data["bambu_mqtt_broker"] | "";
+  c.mqtt_password = data["bambu_mqtt_password"] | "";
+  c.phone_number = data["phone_number"] | "";
+  c.password = data["password"] | "";
+  c.device_serial = data["bambu_device_serial"] | "";
+  c.topic_subscribe = data["bambu_topic_subscribe"] | "";
+  c.topic_publish = data["bambu_topic_publish"] | "";
+  c.username = data["username"] | "";
+  c.access_token = data["access_token"] | "";
+  c.reply_deadline_us = data["reply_deadline_us"] | LATENCY_DEADLINE_US;
+  c.ws_interval_ms = data["ws_interval_ms"] | WS_INTERVAL_MS;
+  c.sniffer = (data["sniffer"] | 1) != 0;
+  c.servo_power = data["servo_power"] | 30;
+  c.prestage_ms = data["prestage_ms"] | 0;
+  c.motor = {MOTOR_PWM_HZ, 150, 0, 100, 0, 60, 100};
+  for (const motor_key_t &key : s_motor_keys) {
+    c.motor.*key.value = data[key.key] | c.motor.*key.value;
+  }
+  c.encoder_mm_per_count = data["encoder_mm_per_count"] | ENCODER_MM_PER_COUNT;
+
+  if (!set_selectors(data["selectors"])) {
+    c.selector_count = 1;
+    c.selectors[0] = SELECTOR_LEGACY;
+  }
+  if (data["servo1_init"].is<int>() && !data["selectors"][0]["init"].is<int>()) {
+    c.selectors[0].init = data["servo1_init"].as<int>();
+  }
+  if (!set_lanes(data["lanes"])) {
+    c.lane_count = sizeof(LANES_LEGACY) / sizeof(LANES_LEGACY[0]);
+    memcpy(c.lanes, LANES_LEGACY, sizeof(LANES_LEGACY));
+  }
+  // 旧的编码器键名
+  for (uint8_t id = 0; id < c.lane_count; id++) {
+    char key_a[] = "encoder0_a";
+    char key_b[] = "encoder0_b";
+    key_a[7] = key_b[7] = '0' + id;
+    if (c.lanes[id].encoder[0] < 0 && data[key_a].is<int>()) {
+      c.lanes[id].encoder[0] = pin_of(data[key_a]);
+      c.lanes[id].encoder[1] = pin_of(data[key_b]);
+    }
+  }
+  if (!c.device_serial.isEmpty()) {
+    set_device_serial(c.device_serial);
+  }
+}
+
+bool Config::set_lanes(JsonVariantConst lanes) {
+  if (!lanes.is<JsonArrayConst>()) {
+    return false;
+  }
+  app_config_t &c = m_values;
+  JsonArrayConst items = lanes.as<JsonArrayConst>();
+  c.lane_count = 0;
+  for (JsonVariantConst item : items) {
+    if (c.lane_count >= LANES_MAX) {
+      break;
+    }
+    lane_config_t &lane = c.lanes[c.lane_count++];
+    lane.motor[0] = pin_of(item["motor"][0]);
+    lane.motor[1] = pin_of(item["motor"][1]);
+    lane.selector = item["selector"] | -1;
+    lane.side = item["side"] | 0;
+    lane.presence = pin_of(item["presence"]);
+    lane.encoder[0] = pin_of(item["encoder"][0]);
+    lane.encoder[1] = pin_of(item["encoder"][1]);
+  }
+  return true;
+}
+
+bool Config::set_selectors(JsonVariantConst selectors) {
+  if (!selectors.is<JsonArrayConst>()) {
+    return false;
+  }
+  app_config_t &c = m_values;
+  JsonArrayConst items = selectors.as<JsonArrayConst>();
+  c.selector_count = 0;
+  for (JsonVariantConst item : items) {
+    if (c.selector_count >= SELECTORS_MAX) {
+      break;
+    }
+    selector_config_t &selector = c.selectors[c.selector_count++];
+    selector.pin = pin_of(item["pin"]);
+    selector.init = item["init"] | 90;
+  }
+  return true;
+}
+
+void Config::set_device_serial(const String &serial) {
+  m_values.device_serial = serial;
+  m_values.topic_subscribe = "device/" + serial + "/report";
+  m_values.topic_publish = "device/" + serial + "/request";
+}
+
+// 超出范围的值改成最接近的合法值，网页上填错了也不会让电机或总线失控
+void Config::validate() {
+  app_config_t &c = m_values;
+  if (c.mode != "LAN" && c.mode != "WAN") {
+    c.mode = "";
+  }
+  c.reply_deadline_us = clamp<uint32_t>(c.reply_deadline_us, 100, 100000);
+  c.ws_interval_ms = clamp<uint32_t>(c.ws_interval_ms, 20, 10000);
+  c.servo_power = clamp(c.servo_power, 0, 90);
+  c.prestage_ms = clamp<uint32_t>(c.prestage_ms, 0, 60000);
+  c.motor.pwm_hz = clamp<uint32_t>(c.motor.pwm_hz, 100, 40000);
+  c.motor.accel_ms = clamp<uint32_t>(c.motor.accel_ms, 0, 10000);
+  c.motor.decel_ms = clamp<uint32_t>(c.motor.decel_ms, 0, 10000);
+  c.motor.feed_speed = clamp<uint32_t>(c.motor.feed_speed, 0, 100);
+  c.motor.approach_speed = clamp<uint32_t>(c.motor.approach_speed, 0, 100);
+  c.motor.retract_speed = clamp<uint32_t>(c.motor.retract_speed, 0, 100);
+  if (!(c.encoder_mm_per_count > 0 && c.encoder_mm_per_count < 100)) {
+    c.encoder_mm_per_count = ENCODER_MM_PER_COUNT;
+  }
+  for (uint8_t i = 0; i < c.selector_count; i++) {
+    c.selectors[i].init = clamp<int16_t>(c.selectors[i].init, 0, 180);
+  }
+  for (uint8_t i = 0; i < c.lane_count; i++) {
+    lane_config_t &lane = c.lanes[i];
+    if (lane.selector < 0 || lane.selector >= c.selector_count) {
+      lane.selector = -1;
+    }
+    lane.side = clamp<int8_t>(lane.side, -1, 1);
+  }
+}
+
+void Config::to_json(JsonDocument &doc) {
+  const app_config_t &c = m_values;
+  doc["WiFi_ssid"] = c.wifi_ssid;
+  doc["WiFi_passphrase"] = c.wifi_passphrase;
+  doc["mode"] = c.mode;
+  doc["bambu_mqtt_broker"] = c.broker;
+  doc["bambu_mqtt_password"] = c.mqtt_password;
+  doc["phone_number"] = c.phone_number;
+  doc["password"] = c.password;
+  doc["bambu_device_serial"] = c.device_serial;
+  doc["bambu_topic_subscribe"] = c.topic_subscribe;
+  doc["bambu_topic_publish"] = c.topic_publish;
+  if (!c.username.isEmpty()) {
+    doc["username"] = c.username;
+    doc["access_token"] = c.access_token;
+  }
+  doc["reply_deadline_us"] = c.reply_deadline_us;
+  doc["ws_interval_ms"] = c.ws_interval_ms;
+  doc["sniffer"] = c.sniffer ? 1 : 0;
+  doc["servo1_init"] = c.selector_count ? c.selectors[0].init : 90;
+  doc["servo_power"] = c.servo_power;
+  doc["prestage_ms"] = c.prestage_ms;
+  for (const motor_key_t &key : s_motor_keys) {
+    doc[key.key] = c.motor.*key.value;
+  }
+  doc["encoder_mm_per_count"] = c.encoder_mm_per_count;
+  JsonArray selectors = doc["selectors"].to<JsonArray>();
+  for (uint8_t i = 0; i < c.selector_count; i++) {
+    JsonObject item = selectors.add<JsonObject>();
+    item["pin"] = (int)c.selectors[i].pin;
+    item["init"] = c.selectors[i].init;
+  }
+  JsonArray lanes = doc["lanes"].to<JsonArray>();
+  for (uint8_t i = 0; i < c.lane_count; i++) {
+    const lane_config_t &lane = c.lanes[i];
+    JsonObject item = lanes.add<JsonObject>();
+    item["motor"][0] = (int)lane.motor[0];
+    item["motor"][1] = (int)lane.motor[1];
+    item["selector"] = (int)lane.selector;
+    item["side"] = (int)lane.side;
+    item["presence"] = (int)lane.presence;
+    item["encoder"][0] = (int)lane.encoder[0];
+    item["encoder"][1] = (int)lane.encoder[1];
+  }
+}
+
+void Config::save() {
+  lock();
+  validate();
+  m_dirty_at = millis();
+  m_dirty = true;
+  unlock();
+}
+
+void Config::flush(bool force) {
+  if (!m_dirty || (!force && millis() - m_dirty_at < CONFIG_SAVE_DELAY_MS)) {
+    return;
+  }
+  // 写文件期间也持有锁，网页任务的修改等写完再进行，两个任务不会同时写
+  lock();
+  m_dirty = false;
+  JsonDocument doc;
+  to_json(doc);
+  String text;
+  serializeJson(doc, text);
+  uint32_t hash = hash_of(text);
+  if (hash == m_saved_hash) {
+    m_unchanged++;
+  } else if (write(text)) {
+    m_saved_hash = hash;
+    m_writes++;
+  } else {
+    m_write_errors++;
+    // 下一次 flush 再试
+    m_dirty = true;
+    m_dirty_at = millis();
+  }
+  unlock();
+}
+
+// 先写临时文件，写完整了再改名替换正式文件；LittleFS 的改名是原子的
+bool Config::write(const String &text) {
+  File file = LittleFS.open(CONFIG_TMP_PATH, "w");
+  if (!file) {
+    return false;
+  }
+  size_t n = file.write((const uint8_t*)text.c_str(), text.length());
+  file.close();
+  if (n != text.length()) {
+    LittleFS.remove(CONFIG_TMP_PATH);
+    return false;
+  }
+  return LittleFS.rename(CONFIG_TMP_PATH, CONFIG_PATH);
+}
@@ -0,0 +1,50 @@
+#include "dispatch.h"
+#include <stddef.h>
+
+uint32_t dispatch_unknown = 0;
+
+static void on_unknown(const bambu_data_t *data) {
+  (void)data;
+  dispatch_unknown++;
+}
+
+enum {
+  TABLE_C5,
+  TABLE_05,
+  TABLE_COUNT,
+};
+
+static dispatch_handler_t s_tables[TABLE_COUNT][256];
+static dispatch_handler_t s_default = on_unknown;
+
+static int table_of(uint8_t type) {
+  switch (type) {
+    case 0xC5: return TABLE_C5;
+    case 0x05: return TABLE_05;
+  }
+  return -1;
+}
+
+bool dispatch_register(uint8_t type, uint8_t cmd, dispatch_handler_t handler) {
+  int table = table_of(type);
+  if (table < 0) {
+    return false;
+  }
+  s_tables[table][cmd] = handler;
+  return true;
+}
+
+void dispatch_set_default(dispatch_handler_t handler) {
+  s_default = handler ? handler : on_unknown;
+}
+
+void dispatch_frame(const bambu_data_t *data) {
+  dispatch_handler_t handler = nullptr;
+  if (data->type == 0xC5) {
+    handler = s_tables[TABLE_C5][data->body_80.cmd];
+  } else if (data->type == 0x05 && bambu_size(data) >= 13 && data->body_00.data[0] == 0x12) {
+    // 13：帧头、cmd、data[0..2] 与 crc16
+    handler = s_tables[TABLE_05][data->body_00.data[2]];
+  }
+  (handler ? handler : s_default)(data);
+}
@@ -0,0 +1,55 @@
+#include "frame_parser.h"
+#include <string.h>
+
+static_assert((FrameParser::CAPACITY & (FrameParser::CAPACITY - 1)) == 0, "");
+static_assert(FrameParser::CAPACITY > 0xFF, "");
+
+size_t FrameParser::write_space() const {
+  size_t free = CAPACITY - used();
+  size_t contiguous = CAPACITY - (m_tail & (CAPACITY - 1));
+  return free < contiguous ? free : contiguous;
+}
+
+void FrameParser::commit(size_t n) {
+  size_t i = m_tail & (CAPACITY - 1);
+  // 同步镜像
+  memcpy(m_buffer + CAPACITY + i, m_buffer + i, n);
+  m_tail += n;
+}
+
+const bambu_data_t* FrameParser::next() {
+  while (true) {
+    // 寻找帧头
+    while (m_head != m_tail && m_buffer[m_head & (CAPACITY - 1)] != BAMBU_HEAD) {
+      skip(1);
+    }
+    const bambu_data_t *data = (const bambu_data_t*)(m_buffer + (m_head & (CAPACITY - 1)));
+    size_t n = used();
+    if (n < 2 || n < bambu_head_size(data)) {
+      return nullptr;
+    }
+    if (!bambu_check_head(data)) {
+      // 0x3D 也可能只是数据，跳过它重新同步
+      m_crc8_errors++;
+      skip(1);
+      continue;
+    }
+    size_t size = bambu_size(data);
+    if (size < bambu_min_size(data) || size > CAPACITY) {
+      m_size_errors++;
+      skip(1);
+      continue;
+    }
+    if (n < size) {
+      return nullptr;
+    }
+    if (!bambu_check_body(data)) {
+      m_crc16_errors++;
+      skip(1);
+      continue;
+    }
+    m_head += size;
+    m_frames++;
+    return data;
+  }
+}
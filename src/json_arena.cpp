@@ -0,0 +1,54 @@
+#include "json_arena.h"
+#include <string.h>
+
+void* JsonArena::allocate(size_t size) {
+  size_t offset = align(m_size);
+  if (offset + HEADER + size > m_capacity) {
+    m_failures++;
+    return nullptr;
+  }
+  *(size_t*)(m_buffer + offset) = size;
+  m_last = offset;
+  m_size = offset + HEADER + size;
+  if (m_size > m_peak) {
+    m_peak = m_size;
+  }
+  return m_buffer + offset + HEADER;
+}
+
+void JsonArena::deallocate(void *ptr) {
+  if (ptr && m_last != NONE && ptr == m_buffer + m_last + HEADER) {
+    m_size = m_last;
+    m_last = NONE;
+  }
+}
+
+void* JsonArena::reallocate(void *ptr, size_t new_size) {
+  if (ptr == nullptr) {
+    return allocate(new_size);
+  }
+  size_t offset = (uint8_t*)ptr - m_buffer - HEADER;
+  if (offset == m_last) {
+    if (offset + HEADER + new_size > m_capacity) {
+      m_failures++;
+      return nullptr;
+    }
+    *(size_t*)(m_buffer + offset) = new_size;
+    m_size = offset + HEADER + new_size;
+    if (m_size > m_peak) {
+      m_peak = m_size;
+    }
+    return ptr;
+  }
+  size_t old_size = block_size(offset);
+  if (new_size <= old_size) {
+    // 不是最后一块，缩小时原地不动
+    *(size_t*)(m_buffer + offset) = new_size;
+    return ptr;
+  }
+  void *p = allocate(new_size);
+  if (p) {
+    memcpy(p, ptr, old_size);
+  }
+  return p;
+}
@@ -0,0 +1,232 @@
+#include "lane_journal.h"
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <esp_rom_crc.h>
+#include <math.h>
+#include <string.h>
+
+#include "bambu.h"
+#include "protocol.h"
+
+LaneJournal lane_journal;
+
+// 最长的记录
+#define JOURNAL_RECORD_MAX (sizeof(journal_head_t) + sizeof(filament_t) + sizeof(uint32_t))
+// 一次写入最多包含的记录：4 个耗材、通道号、送料长度
+#define JOURNAL_BATCH_MAX (JOURNAL_RECORD_MAX * 6)
+
+static size_t expected_size(uint8_t type) {
+  switch (type) {
+    case JOURNAL_FILAMENT: return sizeof(filament_t);
+    case JOURNAL_METERS: return sizeof(journal_meters_t);
+    case JOURNAL_EXTRUDER: return sizeof(journal_extruder_t);
+  }
+  return 0;
+}
+
+// 在 buffer 中追加一条记录，返回新的长度
+static size_t put_record(uint8_t *buffer, size_t size, uint8_t type, const void *payload, uint8_t payload_size) {
+  journal_head_t head = {JOURNAL_MAGIC, type, payload_size};
+  uint8_t *p = buffer + size;
+  memcpy(p, &head, sizeof(head));
+  memcpy(p + sizeof(head), payload, payload_size);
+  uint32_t crc = esp_rom_crc32_le(0, p, sizeof(head) + payload_size);
+  memcpy(p + sizeof(head) + payload_size, &crc, sizeof(crc));
+  return size + sizeof(head) + payload_size + sizeof(crc);
+}
+
+void LaneJournal::restore() {
+  m_mutex = xSemaphoreCreateRecursiveMutex();
+  uint32_t begin = micros();
+  File file = LittleFS.open(JOURNAL_PATH, "r");
+  if (!file) {
+    m_restore_us = micros() - begin;
+    return;
+  }
+  size_t total = file.size();
+  uint8_t record[JOURNAL_RECORD_MAX];
+  while (m_size < total) {
+    journal_head_t *head = (journal_head_t*)record;
+    if (file.read(record, sizeof(*head)) != sizeof(*head)) {
+      break;
+    }
+    size_t size = expected_size(head->type);
+    if (head->magic != JOURNAL_MAGIC || size == 0 || head->size != size) {
+      break;
+    }
+    size_t rest = size + sizeof(uint32_t);
+    if (file.read(record + sizeof(*head), rest) != rest) {
+      break;
+    }
+    uint32_t crc;
+    memcpy(&crc, record + sizeof(*head) + size, sizeof(crc));
+    if (crc != esp_rom_crc32_le(0, record, sizeof(*head) + size)) {
+      break;
+    }
+    apply(head->type, record + sizeof(*head));
+    m_size += sizeof(*head) + rest;
+    m_restored++;
+  }
+  file.close();
+
+  for (const filament_t &filament : m_filaments) {
+    protocol_restore_filament(filament);
+  }
+  previous_extruder = m_previous;
+  next_extruder = m_next;
+  protocol_restore_meters(m_lane, m_meters);
+  m_meters_at = millis();
+
+  // 尾部损坏（写到一半时掉电）：之后的记录不能接在后面，立即用快照替换
+  if (m_size < total) {
+    m_corrupt++;
+    compact();
+  }
+  m_restore_us = micros() - begin;
+}
+
+void LaneJournal::apply(uint8_t type, const uint8_t *payload) {
+  if (type == JOURNAL_FILAMENT) {
+    filament_t filament;
+    memcpy(&filament, payload, sizeof(filament));
+    if (filament.index < 4) {
+      m_filaments[filament.index] = filament;
+    }
+  } else if (type == JOURNAL_METERS) {
+    journal_meters_t meters;
+    memcpy(&meters, payload, sizeof(meters));
+    m_lane = meters.lane;
+    m_meters = meters.meters;
+  } else if (type == JOURNAL_EXTRUDER) {
+    journal_extruder_t extruder;
+    memcpy(&extruder, payload, sizeof(extruder));
+    m_previous = extruder.previous;
+    m_next = extruder.next;
+  }
+}
+
+void LaneJournal::flush(uint32_t now, bool force) {
+  // 写文件期间也持有锁：append 与 compact 的改名不会和另一个任务交错
+  lock();
+  flush_locked(now, force);
+  unlock();
+}
+
+void LaneJournal::flush_locked(uint32_t now, bool force) {
+  filament_t current[4];
+  protocol_filaments(current);
+  int8_t previous = previous_extruder;
+  int8_t next = next_extruder;
+  bool filaments_changed = memcmp(current, m_filaments, sizeof(current)) != 0;
+  bool extruder_changed = previous != m_previous || next != m_next;
+  if ((filaments_changed || extruder_changed) && !m_changed) {
+    m_changed = true;
+    m_changed_at = now;
+  }
+
+  int8_t lane = protocol_active_lane();
+  float meters = lane >= 0 ? filaments_ex[lane].meters : 0;
+  bool meters_due = (lane != m_lane || fabsf(meters - m_meters) >= JOURNAL_METERS_STEP) &&
+                    (force || lane != m_lane || now - m_meters_at >= JOURNAL_METERS_INTERVAL_MS);
+  bool changes_due = m_changed && (force || now - m_changed_at >= JOURNAL_DELAY_MS);
+  if (!meters_due && !changes_due) {
+    return;
+  }
+
+  // 到期的变化合成一次写入
+  uint8_t batch[JOURNAL_BATCH_MAX];
+  size_t size = 0;
+  uint32_t records = 0;
+  if (changes_due) {
+    for (int i = 0; i < 4; i++) {
+      if (memcmp(&current[i], &m_filaments[i], sizeof(filament_t)) != 0) {
+        size = put_record(batch, size, JOURNAL_FILAMENT, &current[i], sizeof(filament_t));
+        records++;
+      }
+    }
+    if (extruder_changed) {
+      journal_extruder_t extruder = {previous, next};
+      size = put_record(batch, size, JOURNAL_EXTRUDER, &extruder, sizeof(extruder));
+      records++;
+    }
+  }
+  if (meters_due) {
+    journal_meters_t item = {lane, meters};
+    size = put_record(batch, size, JOURNAL_METERS, &item, sizeof(item));
+    records++;
+  }
+  if (!append(batch, size)) {
+    // 可能只写了一部分，用旧的状态重写文件，变化留到下一次 flush 再试
+    m_write_errors++;
+    m_changed_at = now;
+    m_meters_at = now;
+    compact();
+    return;
+  }
+  m_appends++;
+  m_records += records;
+  if (changes_due) {
+    memcpy(m_filaments, current, sizeof(current));
+    m_previous = previous;
+    m_next = next;
+    m_changed = false;
+  }
+  if (meters_due) {
+    m_lane = lane;
+    m_meters = meters;
+    m_meters_at = now;
+  }
+  if (m_size > JOURNAL_COMPACT_BYTES) {
+    compact();
+  }
+}
+
+bool LaneJournal::append(const uint8_t *data, size_t size) {
+  lock();
+  File file = LittleFS.open(JOURNAL_PATH, "a");
+  if (!file) {
+    unlock();
+    return false;
+  }
+  size_t n = file.write(data, size);
+  file.close();
+  m_size += n;
+  unlock();
+  return n == size;
+}
+
+size_t LaneJournal::snapshot(uint8_t *buffer) {
+  size_t size = 0;
+  for (const filament_t &filament : m_filaments) {
+    size = put_record(buffer, size, JOURNAL_FILAMENT, &filament, sizeof(filament));
+  }
+  journal_extruder_t extruder = {m_previous, m_next};
+  size = put_record(buffer, size, JOURNAL_EXTRUDER, &extruder, sizeof(extruder));
+  journal_meters_t meters = {m_lane, m_meters};
+  return put_record(buffer, size, JOURNAL_METERS, &meters, sizeof(meters));
+}
+
+// 把当前状态写成新文件，写完整了再改名替换；LittleFS 的改名是原子的
+bool LaneJournal::compact() {
+  lock();
+  uint8_t buffer[JOURNAL_BATCH_MAX];
+  size_t size = snapshot(buffer);
+  File file = LittleFS.open(JOURNAL_TMP_PATH, "w");
+  bool ok = false;
+  if (file) {
+    size_t n = file.write(buffer, size);
+    file.close();
+    ok = n == size && LittleFS.rename(JOURNAL_TMP_PATH, JOURNAL_PATH);
+    if (!ok) {
+      LittleFS.remove(JOURNAL_TMP_PATH);
+    }
+  }
+  if (ok) {
+    m_size = size;
+    m_compactions++;
+  } else {
+    m_write_errors++;
+  }
+  unlock();
+  return ok;
+}
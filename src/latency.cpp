@@ -0,0 +1,84 @@
+#include "latency.h"
+#include <string.h>
+
+const char* const latency_names[LATENCY_CMD_COUNT] = {
+  "03", "04", "05", "06", "08", "05/06", "05/09",
+};
+latency_histogram_t latency_histograms[LATENCY_CMD_COUNT];
+uint32_t latency_deadline_us = LATENCY_DEADLINE_US;
+
+static volatile bool s_reset = false;
+
+int latency_cmd(const bambu_data_t *data) {
+  if (data->type == 0xc5) {
+    switch (data->body_80.cmd) {
+      case 0x03: return LATENCY_CMD_03;
+      case 0x04: return LATENCY_CMD_04;
+      case 0x05: return LATENCY_CMD_05;
+      case 0x06: return LATENCY_CMD_06;
+      case 0x08: return LATENCY_CMD_08;
+    }
+  } else if (data->type == 0x05 && data->body_00.data[0] == 0x12) {
+    switch (data->body_00.data[2]) {
+      case 0x06: return LATENCY_X05_06;
+      case 0x09: return LATENCY_X05_09;
+    }
+  }
+  return -1;
+}
+
+static uint32_t bucket_of(uint32_t us) {
+  if (us < 8) {
+    return us;
+  }
+  uint32_t e = 31 - __builtin_clz(us);
+  uint32_t i = 8 + (e - 3) * 4 + ((us >> (e - 2)) & 3);
+  return i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1;
+}
+
+// 桶中最大的值
+static uint32_t bucket_max(uint32_t i) {
+  if (i < 8) {
+    return i;
+  }
+  uint32_t e = (i - 8) / 4 + 3;
+  uint32_t sub = (i - 8) % 4;
+  return (1u << e) + ((sub + 1) << (e - 2)) - 1;
+}
+
+void latency_record(int cmd, uint32_t us) {
+  if (s_reset) {
+    memset(latency_histograms, 0, sizeof(latency_histograms));
+    s_reset = false;
+  }
+  latency_histogram_t &histogram = latency_histograms[cmd];
+  histogram.buckets[bucket_of(us)]++;
+  histogram.count++;
+  if (us > histogram.max_us) {
+    histogram.max_us = us;
+  }
+  if (us > latency_deadline_us) {
+    histogram.missed++;
+  }
+}
+
+uint32_t latency_percentile(const latency_histogram_t *histogram, uint32_t p) {
+  if (histogram->count == 0) {
+    return 0;
+  }
+  // 向上取整，保证 p99 落在最慢的 1% 里
+  uint32_t rank = ((uint64_t)histogram->count * p + 99) / 100;
+  uint32_t seen = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      uint32_t us = bucket_max(i);
+      return us < histogram->max_us ? us : histogram->max_us;
+    }
+  }
+  return histogram->max_us;
+}
+
+void latency_reset() {
+  s_reset = true;
+}
@@ -1,7 +1,5 @@
 
 #include <Arduino.h>
-#include <PubSubClient.h>
-#include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include <ESP32Servo.h>
 #include <WiFi.h>
@@ -9,178 +7,467 @@
 #include <ESPAsyncWebServer.h>
 #include <Wire.h>
 #include <LittleFS.h>
-#include <HTTPClient.h>
-#include <arduino_base64.hpp>
-#include <CRC16.h>
-#include <CRC8.h>
 #include <ESPmDNS.h>
 #include <ElegantOTA.h>
 
 #include "setups.h"
+#include "actuator_timeline.h"
+#include "bambu.h"
+#include "bus.h"
+#include "cloud.h"
+#include "config.h"
+#include "lane_journal.h"
+#include "web_assets.h"
+#include "hal.h"
+#include "latency.h"
+#include "metrics.h"
+#include "odometer.h"
+#include "protocol.h"
+#include "sniffer.h"
+#include "swap_profiler.h"
+#include "web_state.h"
 
 // 开启调试模式，esp32 将不会连接拓竹
 #define __DEBUG__
 
-// 拓竹指令
-// 执行 Unload 指令，打印机将开始自动加热热端，并切断线材。
-const char* bambu_unload = "{\
-  \"print\": {\
-    \"command\": \"ams_change_filament\",\
-    \"curr_temp\": 210,\
-    \"sequence_id\": \"zp-ams-1\",\
-    \"tar_temp\": 210,\
-    \"target\": 255\
-  }\
-}";
-
-const char* bambu_load = "{\
-  \"print\": {\
-    \"command\": \"ams_change_filament\",\
-    \"curr_temp\": 210,\
-    \"sequence_id\": \"zp-ams-1\",\
-    \"tar_temp\": 210,\
-    \"target\": 254\
-  }\
-}";
-
-const char* bambu_done = "{\
-  \"print\": {\
-    \"command\": \"ams_control\",\
-    \"param\": \"done\",\
-    \"sequence_id\":\"zp-ams-1\"\
-  },\
-  \"user_id\": \"mqttx_c59bbf21\"\
-}";
-
-// 重试|继续打印
-const char* bambu_resume = "{\
-  \"print\": {\
-    \"command\": \"resume\",\
-    \"sequence_id\": \"zp-ams-1\"\
-  },\
-  \"user_id\": \"mqttx_c59bbf21\"\
-}";
-
-const char* bambu_gcode_m109 = "{\
-  \"print\": {\
-    \"command\": \"gcode_line\",\
-    \"sequence_id\": \"zp-ams-1\",\
-    \"param\": \"M109 S\"220\"\
-  },\
-  \"user_id\": \"mqttx_c59bbf21\"\
-}";
-
-const char* bambu_pushall = "{\
-  \"pushing\": {\
-    \"sequence_id\": \"zp-ams-1\",\
-    \"command\": \"pushall\"\
-  }\
-}";
-
-WiFiClientSecure wifi_client;
-PubSubClient bambu_client(wifi_client);
-
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
+// 抓包的二进制流，每条消息是若干条 sniffer 记录
+AsyncWebSocket sniffer_ws("/sniffer");
+
+// 电机调速参数，由 config_apply 从配置复制过来（pwm_hz 只在启动时使用）
+#define MOTOR_PWM_BITS 10
+
+motor_profile_t s_motor_profile = {MOTOR_PWM_HZ, 150, 0, 100, 0, 60, 100};
 
-class Config {
+// 送料编码器每个计数对应的耗材长度
+float s_encoder_mm_per_count = ENCODER_MM_PER_COUNT;
+
+// 减速马达，通过 DRV8833 控制
+// 用慢衰减方式调速：一路输入保持高电平，另一路输出占空比为 (1 - 速度) 的 PWM，两路都为高时刹车
+class Motor {
 public:
-  JsonDocument m_data;
-  void setup() {
-    if (LittleFS.exists("/config.json")) {
-      File file = LittleFS.open("/config.json", "r");
-      deserializeJson(m_data, file);
-      file.close();
+  ESP32PWM m_pwm1;
+  ESP32PWM m_pwm2;
+  float m_speed = 0;          // 当前速度，-1..1，正数为进料方向
+  float m_target = 0;
+  uint32_t m_last_update = 0;
+
+  void setup(int pin1, int pin2) {
+    m_pwm1.attachPin(pin1, s_motor_profile.pwm_hz, MOTOR_PWM_BITS);
+    m_pwm2.attachPin(pin2, s_motor_profile.pwm_hz, MOTOR_PWM_BITS);
+    stop();
+  }
+  // speed 为 0..1
+  void forward(float speed) {
+    m_target = speed;
+  }
+  void backward(float speed) {
+    m_target = -speed;
+  }
+  void stop() {
+    m_target = 0;
+    if (s_motor_profile.decel_ms == 0) {
+      m_speed = 0;
+      apply();
     }
   }
-  template <typename T>
-  T get(const char* key, T default_value) {
-    if (m_data[key].is<T>()) {
-      return m_data[key].as<T>();
+  // 按加减速的斜率逼近目标速度，换向时先减到 0；在主循环中调用
+  void update(uint32_t now) {
+    uint32_t dt = now - m_last_update;
+    m_last_update = now;
+    if (m_speed == m_target) {
+      return;
+    }
+    float goal = m_speed * m_target < 0 ? 0 : m_target;
+    uint32_t ramp_ms = fabsf(goal) > fabsf(m_speed) ? s_motor_profile.accel_ms : s_motor_profile.decel_ms;
+    float step = ramp_ms ? (float)dt / ramp_ms : 2;
+    if (goal > m_speed) {
+      m_speed = fminf(m_speed + step, goal);
     } else {
-      return default_value;
+      m_speed = fmaxf(m_speed - step, goal);
     }
+    apply();
   }
-  void save() {
-    File file = LittleFS.open("/config.json", "w");
-    serializeJson(m_data, file);
-    file.close();
+
+private:
+  void apply() {
+    const uint32_t full = 1 << MOTOR_PWM_BITS;
+    uint32_t off = (uint32_t)((1 - fabsf(m_speed)) * full + 0.5f);
+    if (m_speed > 0) {
+      m_pwm1.write(full);
+      m_pwm2.write(off);
+    } else if (m_speed < 0) {
+      m_pwm1.write(off);
+      m_pwm2.write(full);
+    } else {
+      m_pwm1.write(full);
+      m_pwm2.write(full);
+    }
   }
 };
 
-Config s_config;
+// 有料传感器的电平保持这么久才算变化
+#ifndef LANE_PRESENCE_DEBOUNCE_MS
+#define LANE_PRESENCE_DEBOUNCE_MS 50
+#endif
 
-// 减速马达，通过 DRV8833 控制
-class Motor {
+// 舵机选择器：把一个通道的耗材压到它的电机上，同一时间只能选中其中一个通道
+class Selector {
 public:
-  int m_pin1;
-  int m_pin2;
-
-  void setup(int pin1, int pin2) {
-    m_pin1 = pin1;
-    m_pin2 = pin2;
-    pinMode(m_pin1, OUTPUT);
-    pinMode(m_pin2, OUTPUT);
-    stop();
-  }
-  void forward() {
-    digitalWrite(m_pin1, HIGH);
-    digitalWrite(m_pin2, LOW);
+  Servo m_servo;
+  int m_init = 90;
+  int m_owner = -1;           // 选中的通道
+
+  void setup(int pin, int init) {
+    m_init = init;
+    if (pin >= 0) {
+      m_servo.attach(pin);
+      m_servo.write(m_init);
+    }
   }
-  void backward() {
-    digitalWrite(m_pin1, LOW);
-    digitalWrite(m_pin2, HIGH);
+  void select(int lane, int angle) {
+    m_owner = lane;
+    m_servo.write(angle);
   }
-  void stop() {
-    digitalWrite(m_pin1, HIGH);
-    digitalWrite(m_pin2, HIGH);
+  void release() {
+    m_owner = -1;
+    m_servo.write(m_init);
   }
 };
 
+// 一个通道：电机、选择器上的位置、有料传感器与编码器，都是可选的
+class Lane {
+public:
+  Motor m_motor;
+  bool m_configured = false;
+  bool m_has_motor = false;
+  int m_selector = -1;
+  int m_side = 0;             // 选中时舵机从 m_init 转动的方向，-1 或 1
+  int m_presence_pin = -1;    // 低电平表示有料；没有传感器时视为一直有料
+  bool m_present = true;
+  bool m_presence_raw = true;
+  uint32_t m_presence_changed = 0;
+  // 正在进料及开始的时间，用于从快速阶段切换到接近阶段
+  bool m_feeding = false;
+  uint32_t m_feed_start = 0;
+};
+
 class AMSLite {
 public:
-  Motor m_motor0;
-  Motor m_motor1;
-  Servo m_servo;
-  int m_servo_init = 90;
+  Lane m_lanes[LANES_MAX];
+  Selector m_selectors[SELECTORS_MAX];
   int m_servo_power = 30;
-
-  void setup(int m0pin1, int m0pin2, int m1pin1, int m1pin2, int s1pin1) {
-    m_motor0.setup(m0pin1, m0pin2);
-    m_motor1.setup(m1pin1, m1pin2);
-    m_servo.attach(s1pin1);
-    m_servo_init = s_config.get("servo1_init", 90);
-    m_servo_power = s_config.get("servo_power", 30);
+  // 每个通道一位，由 update() 更新，总线任务读取
+  volatile uint8_t m_online = 0;
+
+  // 按配置的 selectors 与 lanes 接线，只在启动时调用一次
+  void setup(const app_config_t &config) {
+    m_servo_power = config.servo_power;
+    for (uint8_t i = 0; i < config.selector_count; i++) {
+      m_selectors[i].setup(config.selectors[i].pin, config.selectors[i].init);
+    }
+    for (uint8_t id = 0; id < config.lane_count; id++) {
+      const lane_config_t &item = config.lanes[id];
+      Lane &lane = m_lanes[id];
+      lane.m_configured = true;
+      if (item.motor[0] >= 0 && item.motor[1] >= 0) {
+        lane.m_motor.setup(item.motor[0], item.motor[1]);
+        lane.m_has_motor = true;
+      }
+      lane.m_selector = item.selector;
+      lane.m_side = item.side;
+      lane.m_presence_pin = item.presence;
+      if (lane.m_presence_pin >= 0) {
+        pinMode(lane.m_presence_pin, INPUT_PULLUP);
+        lane.m_present = lane.m_presence_raw = digitalRead(lane.m_presence_pin) == LOW;
+      }
+      if (item.encoder[0] >= 0 && !odometer_setup(id, item.encoder[0], item.encoder[1])) {
+        Serial.printf("Encoder %u setup failed\n", id);
+      }
+    }
+    update_online();
   }
 
+  // 总线每次轮询都会重复请求同一个动作，已经在进料时不重新开始快速阶段
   void forward(int id) {
-    if (id == 0) {
-      m_servo.write(m_servo_init - m_servo_power);
-      m_motor0.forward();
-    } else if (id == 1) {
-      m_servo.write(m_servo_init + m_servo_power);
-      m_motor1.forward();
+    Lane *lane = this->lane(id);
+    if (lane == nullptr || lane->m_feeding) {
+      return;
     }
+    select(id);
+    odometer_set_direction(id, 1);
+    lane->m_motor.forward(s_motor_profile.feed_speed / 100.0f);
+    lane->m_feeding = true;
+    lane->m_feed_start = millis();
   }
 
   void backward(int id) {
-    if (id == 0) {
-      m_motor0.backward();
-      m_servo.write(m_servo_init - m_servo_power);
-    } else if (id == 1) {
-      m_motor1.backward();
-      m_servo.write(m_servo_init + m_servo_power);
+    Lane *lane = this->lane(id);
+    if (lane == nullptr) {
+      return;
+    }
+    lane->m_feeding = false;
+    select(id);
+    odometer_set_direction(id, -1);
+    lane->m_motor.backward(s_motor_profile.retract_speed / 100.0f);
+  }
+
+  // 减速期间的计数仍算作上一个方向，下一次启动时再切换
+  void stop(int id) {
+    Lane *lane = this->lane(id);
+    if (lane == nullptr) {
+      return;
+    }
+    lane->m_feeding = false;
+    lane->m_motor.stop();
+    if (lane->m_selector >= 0 && m_selectors[lane->m_selector].m_owner == id) {
+      m_selectors[lane->m_selector].release();
     }
   }
+
   void stop() {
-    m_motor0.stop();
-    m_motor1.stop();
-    m_servo.write(m_servo_init);
+    for (int id = 0; id < LANES_MAX; id++) {
+      stop(id);
+    }
+  }
+
+  // 是否有电机在转（或正在减速）
+  bool running() const {
+    for (const Lane &lane : m_lanes) {
+      if (lane.m_has_motor && lane.m_motor.m_target != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 在主循环中调用
+  void update(uint32_t now) {
+    for (Lane &lane : m_lanes) {
+      if (!lane.m_configured) {
+        continue;
+      }
+      if (lane.m_feeding && s_motor_profile.feed_fast_ms && now - lane.m_feed_start >= s_motor_profile.feed_fast_ms) {
+        lane.m_motor.forward(s_motor_profile.approach_speed / 100.0f);
+      }
+      if (lane.m_has_motor) {
+        lane.m_motor.update(now);
+      }
+      if (lane.m_presence_pin >= 0) {
+        bool raw = digitalRead(lane.m_presence_pin) == LOW;
+        if (raw != lane.m_presence_raw) {
+          lane.m_presence_raw = raw;
+          lane.m_presence_changed = now;
+        } else if (raw != lane.m_present && now - lane.m_presence_changed >= LANE_PRESENCE_DEBOUNCE_MS) {
+          lane.m_present = raw;
+        }
+      }
+    }
+    update_online();
+  }
+
+private:
+  // 只返回有电机的通道
+  Lane* lane(int id) {
+    return id >= 0 && id < LANES_MAX && m_lanes[id].m_has_motor ? &m_lanes[id] : nullptr;
+  }
+
+  // 选择器转到这个通道，先停下同一选择器上的其它通道
+  void select(int id) {
+    int selector = m_lanes[id].m_selector;
+    if (selector < 0) {
+      return;
+    }
+    for (int other = 0; other < LANES_MAX; other++) {
+      if (other != id && m_lanes[other].m_selector == selector && m_lanes[other].m_has_motor) {
+        m_lanes[other].m_feeding = false;
+        m_lanes[other].m_motor.stop();
+      }
+    }
+    m_selectors[selector].select(id, m_selectors[selector].m_init + m_lanes[id].m_side * m_servo_power);
+  }
+
+  void update_online() {
+    uint8_t online = 0;
+    for (int id = 0; id < LANES_MAX; id++) {
+      if (m_lanes[id].m_configured && m_lanes[id].m_present) {
+        online |= 1 << id;
+      }
+    }
+    m_online = online;
   }
 };
 
 AMSLite ams_lite1;
 
+// 硬件抽象层的实现
+uint32_t hal_millis() {
+  return millis();
+}
+
+uint32_t hal_micros() {
+  return micros();
+}
+
+uint32_t hal_cycles() {
+  return ESP.getCycleCount();
+}
+
+uint32_t hal_cycles_per_us() {
+  return ESP.getCpuFreqMHz();
+}
+
+static portMUX_TYPE s_hal_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void hal_critical_enter() {
+  portENTER_CRITICAL(&s_hal_mux);
+}
+
+void hal_critical_exit() {
+  portEXIT_CRITICAL(&s_hal_mux);
+}
+
+void hal_log(const char *fmt, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buffer, sizeof(buffer), fmt, args);
+  va_end(args);
+  Serial.print(buffer);
+}
+
+void hal_uart_write(const uint8_t *data, size_t size) {
+  bus_write(data, size);
+}
+
+void hal_bus_actuator(uint8_t action, uint8_t lane) {
+  bus_post_actuator(action, lane);
+}
+
+void hal_monitor_frame(const bambu_data_t *data) {
+  bus_post_frame(data);
+}
+
+void hal_actuator(uint8_t action, uint8_t lane) {
+  if (action == ACTUATOR_FORWARD) {
+    ams_lite1.forward(lane);
+  } else if (action == ACTUATOR_BACKWARD) {
+    ams_lite1.backward(lane);
+  } else if (lane == LANE_ALL) {
+    ams_lite1.stop();
+  } else {
+    ams_lite1.stop(lane);
+  }
+  swap_profiler.motor(ams_lite1.running(), millis());
+}
+
+bool hal_mqtt_publish(const char *payload) {
+  return cloud_publish(payload);
+}
+
+void hal_lane_flags(uint8_t *online, uint8_t *nfc) {
+  *online = ams_lite1.m_online;
+  // 没有 NFC 读卡器
+  *nfc = 0;
+}
+
+bool hal_feed_meters(uint8_t lane, float *meters) {
+  if (!odometer_configured(lane)) {
+    return false;
+  }
+  *meters = odometer_count(lane) * s_encoder_mm_per_count / 1000.0f;
+  return true;
+}
+
+// 网页状态的推送间隔
+uint32_t s_ws_interval_ms = WS_INTERVAL_MS;
+
+// 抓包缓冲区的大小，须是 2 的幂
+#ifndef SNIFFER_RING_SIZE
+#define SNIFFER_RING_SIZE 16384
+#endif
+#ifndef SNIFFER_PSRAM_RING_SIZE
+#define SNIFFER_PSRAM_RING_SIZE 262144
+#endif
+// 每条 /sniffer 消息最多这么多字节
+#define SNIFFER_WS_MESSAGE_SIZE 2048
+
+// 错过了增量（刚连接或发送队列已满）的网页，下次推送完整快照
+#define WS_MAX_STALE 8
+static uint32_t s_ws_stale[WS_MAX_STALE];
+static size_t s_ws_stale_count = 0;
+static portMUX_TYPE s_ws_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void ws_mark_stale(uint32_t id, bool stale) {
+  portENTER_CRITICAL(&s_ws_mux);
+  size_t i = 0;
+  while (i < s_ws_stale_count && s_ws_stale[i] != id) {
+    i++;
+  }
+  if (stale && i == s_ws_stale_count && i < WS_MAX_STALE) {
+    s_ws_stale[s_ws_stale_count++] = id;
+  } else if (!stale && i < s_ws_stale_count) {
+    s_ws_stale[i] = s_ws_stale[--s_ws_stale_count];
+  }
+  portEXIT_CRITICAL(&s_ws_mux);
+}
+
+static bool ws_is_stale(uint32_t id) {
+  bool stale = false;
+  portENTER_CRITICAL(&s_ws_mux);
+  for (size_t i = 0; i < s_ws_stale_count; i++) {
+    stale |= s_ws_stale[i] == id;
+  }
+  portEXIT_CRITICAL(&s_ws_mux);
+  return stale;
+}
+
+void on_ws_event(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+  if (type == WS_EVT_CONNECT) {
+    ws_mark_stale(client->id(), true);
+  } else if (type == WS_EVT_DISCONNECT) {
+    ws_mark_stale(client->id(), false);
+  }
+}
+
+// 消息只编码一次，所有网页共享同一块缓冲区
+static AsyncWebSocketSharedBuffer ws_buffer(const char *text, size_t len) {
+  return std::make_shared<std::vector<uint8_t>>((const uint8_t*)text, (const uint8_t*)text + len);
+}
+
+// 发送队列已满的网页直接跳过，不再排队
+static bool ws_send(AsyncWebSocketClient &client, const AsyncWebSocketSharedBuffer &buffer) {
+  if (client.status() != WS_CONNECTED) {
+    return false;
+  }
+  if (client.queueIsFull()) {
+    metrics.ws_dropped++;
+    return false;
+  }
+  return client.text(buffer);
+}
+
+static void ws_send_all(const char *text, size_t len) {
+  AsyncWebSocketSharedBuffer buffer = ws_buffer(text, len);
+  for (AsyncWebSocketClient &client : ws.getClients()) {
+    ws_send(client, buffer);
+  }
+}
+
+// 给网页弹出一条提示
+void ws_message(const char *fmt, ...) {
+  char message[192];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(message, sizeof(message), fmt, args);
+  va_end(args);
+  JsonDocument data;
+  data["message"] = message;
+  char text[256];
+  ws_send_all(text, serializeJson(data, text, sizeof(text)));
+}
+
 double get_arg(AsyncWebServerRequest *request, const char* name, double default_value = 0.0) {
   if (request->hasParam(name)) {
     return request->getParam(name)->value().toDouble();
@@ -188,87 +475,175 @@ double get_arg(AsyncWebServerRequest *request, const char* name, double default_
   return default_value;
 }
 
-// 打印机通过 mqtt 发送来的信息
-// -1 表示未知
-int print_error = -1;
-int ams_status = -1;
-// 进料开关状态，0 无料，1 有料
-int hw_switch_state = -1;
-// 黑客入侵[打印进度]，用[mc_percent - 110]表示接下来期望换用的挤出机id
-int mc_percent = -1;
-String gcode_state;
-
-// ZP AMS 状态:
-// 自动换料的状态，0 空闲，1 忙碌
-int zp_state = 0;
-// 有待退料管道
-int previous_extruder = 0;
-// 有待进料管道
-int next_extruder = 0;
+// 把连接拓竹用到的配置交给 cloud 任务，有变化时它会重新连接
+void cloud_apply_config() {
+  cloud_config_t config;
+  app_config.lock();
+  const app_config_t &values = app_config.m_values;
+  config.mode = values.mode;
+  config.broker = values.broker;
+  config.mqtt_password = values.mqtt_password;
+  config.topic_subscribe = values.topic_subscribe;
+  config.topic_publish = values.topic_publish;
+  config.phone_number = values.phone_number;
+  config.password = values.password;
+  config.username = values.username;
+  config.access_token = values.access_token;
+  app_config.unlock();
+  cloud_configure(config);
+}
+
+// 把可以随时修改的配置复制到各处使用的变量，启动时和每次修改后调用；
+// 引脚、motor_pwm_hz 只在启动时由 AMSLite::setup 使用
+void config_apply() {
+  app_config.lock();
+  const app_config_t &values = app_config.m_values;
+  latency_deadline_us = values.reply_deadline_us;
+  sniffer_enabled = values.sniffer;
+  s_ws_interval_ms = values.ws_interval_ms;
+  // 电机已经按启动时的频率接好，之后修改的 pwm_hz 等重启再用
+  static bool applied = false;
+  uint32_t pwm_hz = applied ? s_motor_profile.pwm_hz : values.motor.pwm_hz;
+  s_motor_profile = values.motor;
+  s_motor_profile.pwm_hz = pwm_hz;
+  applied = true;
+  s_encoder_mm_per_count = values.encoder_mm_per_count;
+  bambu_prestage_ms = values.prestage_ms;
+  ams_lite1.m_servo_power = values.servo_power;
+  for (uint8_t i = 0; i < values.selector_count; i++) {
+    ams_lite1.m_selectors[i].m_init = values.selectors[i].init;
+  }
+  app_config.unlock();
+}
 
 void get_config(AsyncWebServerRequest *request) {
   AsyncResponseStream *response = request->beginResponseStream("application/json");
-  serializeJson(s_config.m_data, *response);
-  if (bambu_client.connected()) {
-    bambu_client.publish(s_config.m_data["bambu_topic_publish"], bambu_pushall);
+  JsonDocument data;
+  app_config.lock();
+  app_config.to_json(data);
+  app_config.unlock();
+  serializeJson(data, *response);
+  if (cloud_connected()) {
+    hal_mqtt_publish(bambu_pushall);
   }
   request->send(response);
 }
 
+// 表单中的文本项
+typedef struct {
+  const char *key;
+  String app_config_t::*value;
+} text_config_t;
+
+static const text_config_t text_config[] = {
+  {"WiFi_ssid", &app_config_t::wifi_ssid},
+  {"WiFi_passphrase", &app_config_t::wifi_passphrase},
+  {"mode", &app_config_t::mode},
+  {"phone_number", &app_config_t::phone_number},
+  {"password", &app_config_t::password},
+  {"bambu_mqtt_broker", &app_config_t::broker},
+  {"bambu_mqtt_password", &app_config_t::mqtt_password},
+};
+
+// 数值项
+typedef struct {
+  const char *key;
+  uint32_t *value;
+} number_config_t;
+
+static const number_config_t number_config[] = {
+  {"reply_deadline_us", &app_config.m_values.reply_deadline_us},
+  {"ws_interval_ms", &app_config.m_values.ws_interval_ms},
+  {"prestage_ms", &app_config.m_values.prestage_ms},
+  {"motor_pwm_hz", &app_config.m_values.motor.pwm_hz},
+  {"motor_accel_ms", &app_config.m_values.motor.accel_ms},
+  {"motor_decel_ms", &app_config.m_values.motor.decel_ms},
+  {"motor_feed_speed", &app_config.m_values.motor.feed_speed},
+  {"motor_feed_fast_ms", &app_config.m_values.motor.feed_fast_ms},
+  {"motor_approach_speed", &app_config.m_values.motor.approach_speed},
+  {"motor_retract_speed", &app_config.m_values.motor.retract_speed},
+};
+
 void put_config(AsyncWebServerRequest *request) {
   const AsyncWebParameter* param = nullptr;
-  param = request->getParam("WiFi_ssid");
-  if (param) {
-    s_config.m_data["WiFi_ssid"] = param->value();
+  // 先检查 JSON 项，格式不对时整个请求都不生效
+  JsonDocument lanes;
+  JsonDocument selectors;
+  for (JsonDocument *doc : {&lanes, &selectors}) {
+    const char *key = doc == &lanes ? "lanes" : "selectors";
+    param = request->getParam(key);
+    if (param && (deserializeJson(*doc, param->value()) || !doc->is<JsonArray>())) {
+      request->send(400, "text", String(key) + " 须是 JSON 数组");
+      return;
+    }
   }
-  param = request->getParam("WiFi_passphrase");
+
+  app_config.lock();
+  app_config_t &values = app_config.m_values;
+  for (const text_config_t &item : text_config) {
+    param = request->getParam(item.key);
+    if (param) {
+      values.*item.value = param->value();
+    }
+  }
+  param = request->getParam("bambu_device_serial");
   if (param) {
-    s_config.m_data["WiFi_passphrase"] = param->value();
+    app_config.set_device_serial(param->value());
   }
-  // 如果没有联网，则进行连接；如果已经联网，则忽略
-  const String& ssid = s_config.m_data["WiFi_ssid"].as<String>();
-  const String& passphrase = s_config.m_data["WiFi_passphrase"].as<String>();
-  if (WiFi.status() != WL_CONNECTED && !ssid.isEmpty() && !passphrase.isEmpty()) {
-    WiFi.begin(ssid, passphrase);
+  for (const number_config_t &item : number_config) {
+    param = request->getParam(item.key);
+    if (param) {
+      *item.value = param->value().toInt();
+    }
   }
-  param = request->getParam("mode");
-  if (param) {
-    s_config.m_data["mode"] = param->value();
+  param = request->getParam("servo1_init");
+  if (param && values.selector_count) {
+    values.selectors[0].init = param->value().toInt();
   }
-  param = request->getParam("phone_number");
+  param = request->getParam("servo_power");
   if (param) {
-    s_config.m_data["phone_number"] = param->value();
+    values.servo_power = param->value().toInt();
   }
-  param = request->getParam("password");
+  param = request->getParam("sniffer");
   if (param) {
-    s_config.m_data["password"] = param->value();
+    values.sniffer = param->value().toInt() != 0;
   }
-  param = request->getParam("bambu_mqtt_broker");
+  param = request->getParam("encoder_mm_per_count");
   if (param) {
-    s_config.m_data["bambu_mqtt_broker"] = param->value();
+    values.encoder_mm_per_count = param->value().toFloat();
   }
-  param = request->getParam("bambu_mqtt_password");
-  if (param) {
-    s_config.m_data["bambu_mqtt_password"] = param->value();
+  // 接线重启后生效
+  for (uint8_t id = 0; id < values.lane_count; id++) {
+    char key[] = "encoder0_a";
+    key[7] = '0' + id;
+    param = request->getParam(key);
+    if (param) {
+      values.lanes[id].encoder[0] = param->value().toInt();
+    }
+    key[9] = 'b';
+    param = request->getParam(key);
+    if (param) {
+      values.lanes[id].encoder[1] = param->value().toInt();
+    }
   }
-  param = request->getParam("bambu_device_serial");
-  if (param) {
-    const String& bambu_device_serial = param->value();
-    s_config.m_data["bambu_device_serial"] = bambu_device_serial;
-    s_config.m_data["bambu_topic_subscribe"] = "device/" + bambu_device_serial + "/report";
-    s_config.m_data["bambu_topic_publish"] = "device/" + bambu_device_serial + "/request";
+  if (!lanes.isNull()) {
+    app_config.set_lanes(lanes.as<JsonVariantConst>());
   }
-  param = request->getParam("servo1_init");
-  if (param) {
-    s_config.m_data["servo1_init"] = param->value().toInt();
-    ams_lite1.m_servo_init = param->value().toInt();
+  if (!selectors.isNull()) {
+    app_config.set_selectors(selectors.as<JsonVariantConst>());
   }
-  param = request->getParam("servo_power");
-  if (param) {
-    s_config.m_data["servo_power"] = param->value().toInt();
-    ams_lite1.m_servo_power = param->value().toInt();
+  // 仍持有锁时校验（锁可以重入），其他任务看不到没有校验过的值
+  app_config.save();
+  String ssid = values.wifi_ssid;
+  String passphrase = values.wifi_passphrase;
+  app_config.unlock();
+  config_apply();
+  cloud_apply_config();
+
+  // 如果没有联网，则进行连接；如果已经联网，则忽略
+  if (WiFi.status() != WL_CONNECTED && !ssid.isEmpty() && !passphrase.isEmpty()) {
+    WiFi.begin(ssid, passphrase);
   }
-  s_config.save();
   request->send(200);
 }
 
@@ -282,219 +657,363 @@ void get_local_ip(AsyncWebServerRequest *request) {
   request->send(response);
 }
 
+// 网页请求的电机动作：网页任务只投递，由 loop() 与总线的请求一起执行，
+// 电机与舵机因此只在 loop() 中驱动。只保留最新的一个
+static bus_actuator_t s_web_actuator;
+static bool s_web_actuator_pending = false;
+static portMUX_TYPE s_web_actuator_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void post_web_actuator(uint8_t action, uint8_t lane) {
+  portENTER_CRITICAL(&s_web_actuator_mux);
+  s_web_actuator.action = action;
+  s_web_actuator.lane = lane;
+  s_web_actuator_pending = true;
+  portEXIT_CRITICAL(&s_web_actuator_mux);
+}
+
+static bool receive_web_actuator(bus_actuator_t *actuator) {
+  portENTER_CRITICAL(&s_web_actuator_mux);
+  bool pending = s_web_actuator_pending;
+  *actuator = s_web_actuator;
+  s_web_actuator_pending = false;
+  portEXIT_CRITICAL(&s_web_actuator_mux);
+  return pending;
+}
+
 void unload(AsyncWebServerRequest* request) {
-  if (gcode_state != "FINISH" && gcode_state != "FAILURE") {
+  if (strcmp(gcode_state, "FINISH") != 0 && strcmp(gcode_state, "FAILURE") != 0) {
     request->send(400, "text", "当前非暂停状态，不可操控！");
     return;
   }
   previous_extruder = get_arg(request, "previous_extruder", 0);
-  bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_unload);
+  hal_mqtt_publish(bambu_unload);
   request->send(200);
 }
 
 void load(AsyncWebServerRequest* request) {
-  if (gcode_state != "FINISH") {
+  if (strcmp(gcode_state, "FINISH") != 0) {
     request->send(400, "text", "当前非暂停状态，不可操控！");
     return;
   }
   next_extruder = get_arg(request, "next_extruder", 0);
-  bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_load);
+  hal_mqtt_publish(bambu_load);
   request->send(200);
 }
 
 void stop(AsyncWebServerRequest* request) {
-  ams_lite1.stop();
+  // 先取消还没执行的步骤，免得电机又被启动
+  actuator_timeline.cancel();
+  post_web_actuator(ACTUATOR_STOP, LANE_ALL);
   previous_extruder = get_arg(request, "previous_extruder");
   next_extruder = get_arg(request, "next_extruder");
   request->send(200);
 }
 
 void resume(AsyncWebServerRequest* request) {
-  bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_resume);
+  hal_mqtt_publish(bambu_resume);
   request->send(200);
 }
 
 void gcode_m109(AsyncWebServerRequest* request) {
-  bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_gcode_m109);
+  hal_mqtt_publish(bambu_gcode_m109);
   request->send(200);
 }
 
 void test_forward(AsyncWebServerRequest* request) {
   // FINISH
-  if (gcode_state != "FINISH") {
+  if (strcmp(gcode_state, "FINISH") != 0) {
     request->send(400, "text", "当前非暂停状态，不可操控！");
     return;
   }
   next_extruder = get_arg(request, "next_extruder", 0);
-  ams_lite1.forward(next_extruder);
+  actuator_timeline.cancel();
+  post_web_actuator(ACTUATOR_FORWARD, next_extruder);
   previous_extruder = next_extruder;
   request->send(200);
 }
 
 void test_backward(AsyncWebServerRequest* request) {
-  if (gcode_state != "FINISH") {
+  if (strcmp(gcode_state, "FINISH") != 0) {
     request->send(400, "text", "当前非暂停状态，不可操控！");
     return;
   }
   previous_extruder = get_arg(request, "previous_extruder", 0);
-  ams_lite1.backward(previous_extruder);
+  actuator_timeline.cancel();
+  post_web_actuator(ACTUATOR_BACKWARD, previous_extruder);
   next_extruder = previous_extruder;
   request->send(200);
 }
 
+// 最近几次换料各阶段的耗时，以及所有换料的累计
+static void swap_to_json(const swap_record_t &record, JsonObject item) {
+  item["id"] = record.id;
+  item["from"] = record.from_lane;
+  item["to"] = record.to_lane;
+  item["total_ms"] = record.total_ms;
+  item["completed"] = record.completed;
+  item["motor_ms"] = record.motor_ms;
+  item["retries"] = record.retries;
+  item["errors"] = record.errors;
+  JsonObject phases = item["phases_ms"].to<JsonObject>();
+  for (int i = 0; i < SWAP_PHASES; i++) {
+    if (record.phase_ms[i]) {
+      phases[swap_phase_name(i)] = record.phase_ms[i];
+    }
+  }
+  // [ams_status, 距开始的毫秒数]
+  JsonArray transitions = item["transitions"].to<JsonArray>();
+  for (int i = 0; i < record.transition_count; i++) {
+    JsonArray transition = transitions.add<JsonArray>();
+    transition.add(record.transitions[i].ams_status);
+    transition.add(record.transitions[i].at_ms);
+  }
+}
+
+void get_swaps(AsyncWebServerRequest* request) {
+  static swap_snapshot_t snapshot;
+  swap_profiler.snapshot(&snapshot);
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonDocument data;
+  const swap_totals_t &totals = snapshot.totals;
+  data["swaps"] = totals.swaps;
+  data["completed"] = totals.completed;
+  data["avg_ms"] = totals.completed ? totals.total_ms / totals.completed : 0;
+  data["max_ms"] = totals.max_ms;
+  data["avg_motor_ms"] = totals.swaps ? totals.motor_ms / totals.swaps : 0;
+  data["retries"] = totals.retries;
+  data["errors"] = totals.errors;
+  uint32_t phase_total = 0;
+  for (int i = 0; i < SWAP_PHASES; i++) {
+    phase_total += totals.phase_ms[i];
+  }
+  for (int i = 0; i < SWAP_PHASES; i++) {
+    JsonObject phase = data["phases"][swap_phase_name(i)].to<JsonObject>();
+    phase["avg_ms"] = totals.swaps ? totals.phase_ms[i] / totals.swaps : 0;
+    phase["max_ms"] = totals.phase_max_ms[i];
+    // 在所有换料时间中所占的百分比
+    phase["share"] = phase_total ? (uint32_t)((uint64_t)totals.phase_ms[i] * 100 / phase_total) : 0;
+  }
+  JsonArray recent = data["recent"].to<JsonArray>();
+  for (size_t i = snapshot.count; i > 0; i--) {
+    swap_to_json(snapshot.records[i - 1], recent.add<JsonObject>());
+  }
+  if (snapshot.active) {
+    JsonObject current = data["current"].to<JsonObject>();
+    swap_to_json(snapshot.current, current);
+    uint32_t now = millis();
+    current["total_ms"] = now - snapshot.current.start_ms;
+    current["phase"] = swap_phase_name(snapshot.phase);
+    current["phase_ms"] = now - snapshot.phase_start;
+  }
+  serializeJson(data, *response);
+  request->send(response);
+}
+
+// 总线应答耗时，带上 reset 参数则清零
+void get_latency(AsyncWebServerRequest* request) {
+  if (request->hasParam("reset")) {
+    latency_reset();
+  }
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonDocument data;
+  data["deadline_us"] = latency_deadline_us;
+  for (int i = 0; i < LATENCY_CMD_COUNT; i++) {
+    const latency_histogram_t *histogram = &latency_histograms[i];
+    JsonObject item = data["cmd"][latency_names[i]].to<JsonObject>();
+    item["count"] = histogram->count;
+    item["p50_us"] = latency_percentile(histogram, 50);
+    item["p99_us"] = latency_percentile(histogram, 99);
+    item["max_us"] = histogram->max_us;
+    item["missed"] = histogram->missed;
+  }
+  serializeJson(data, *response);
+  request->send(response);
+}
+
+// 下载抓包文件，内容是缓冲区中现有的记录，格式见 sniffer.h
+void get_capture(AsyncWebServerRequest* request) {
+  std::shared_ptr<uint32_t> cursor = std::make_shared<uint32_t>(sniffer.tail());
+  uint32_t end = sniffer.head();
+  AsyncWebServerResponse *response = request->beginChunkedResponse("application/octet-stream",
+    [cursor, end](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+      size_t n = 0;
+      if (index == 0) {
+        memcpy(buffer, SNIFFER_MAGIC, sizeof(SNIFFER_MAGIC));
+        n = sizeof(SNIFFER_MAGIC);
+      }
+      if ((int32_t)(*cursor - end) < 0) {
+        n += sniffer.read(cursor.get(), buffer + n, max_len - n);
+        // 返回 0 会结束应答；还有记录但这次的空间放不下一条时，等发送窗口空出来再试
+        if (n == 0 && (int32_t)(*cursor - end) < 0) {
+          return RESPONSE_TRY_AGAIN;
+        }
+      }
+      return n;
+    });
+  response->addHeader("Content-Disposition", "attachment; filename=\"amslite.bblcap\"");
+  request->send(response);
+}
+
+// Prometheus 文本格式的运行统计，在预先分配的缓冲区中生成
+void get_metrics(AsyncWebServerRequest* request) {
+  // 在静态缓冲区中生成，发送前复制一份交给应答：应答要分几次 TCP 确认才能发完，
+  // 直接引用缓冲区的话，期间的下一次抓取会把两次的内容混在一个应答里
+  static char buffer[8192];
+  MetricsWriter writer(buffer, sizeof(buffer));
+  metrics_render(writer);
+  metrics.loop_max_us = 0;
+  writer.counter("amslite_bus_crc8_errors_total", "Frames with a bad header crc8", bus_parser.m_crc8_errors);
+  writer.counter("amslite_bus_crc16_errors_total", "Frames with a bad crc16", bus_parser.m_crc16_errors);
+  writer.counter("amslite_bus_size_errors_total", "Frames with an impossible size", bus_parser.m_size_errors);
+  writer.counter("amslite_bus_resync_dropped_bytes_total", "Bytes discarded while resyncing", bus_parser.m_dropped_bytes);
+  writer.counter("amslite_bus_uart_overflows_total", "UART FIFO or ring buffer overflows", bus_uart_overflows);
+  writer.counter("amslite_bus_uart_errors_total", "UART parity or framing errors", bus_uart_errors);
+  writer.gauge("amslite_bus_tx_turnaround_us", "Time to release the bus after a reply, minus the time on the wire", bus_turnaround_us);
+  writer.gauge("amslite_bus_tx_turnaround_max_us", "Longest bus release time after a reply, minus the time on the wire", bus_turnaround_max_us);
+  writer.counter("amslite_bus_tx_timeouts_total", "Replies that did not finish sending in time", bus_tx_timeouts);
+  writer.counter("amslite_bus_collisions_total", "Replies that collided with another sender", bus_collisions);
+  writer.counter("amslite_bus_monitor_dropped_total", "Frames not forwarded to the web page", bus_dropped_frames);
+  writer.gauge("amslite_mqtt_arena_peak_bytes", "Peak use of the MQTT report parse arena", bambu_json_arena.m_peak);
+  cloud_health_t health;
+  cloud_health(&health);
+  writer.gauge("amslite_mqtt_state", "0 idle, 1 login, 2 connecting, 3 connected, 4 backoff, 5 stopped", health.state);
+  writer.gauge("amslite_mqtt_connected_seconds", "Time since the MQTT connection was established",
+               health.state == CLOUD_CONNECTED ? (millis() - health.connected_at) / 1000 : 0);
+  writer.gauge("amslite_mqtt_consecutive_failures", "Connection or login failures since the last success", health.consecutive_failures);
+  writer.gauge("amslite_mqtt_backoff_ms", "Current wait before the next connection attempt", health.backoff_ms);
+  writer.gauge("amslite_mqtt_last_attempt_ms", "Duration of the last connection or login attempt", health.last_attempt_ms);
+  writer.gauge("amslite_mqtt_max_attempt_ms", "Longest connection or login attempt", health.max_attempt_ms);
+  writer.counter("amslite_mqtt_disconnects_total", "MQTT connections lost after being established", health.disconnects);
+  writer.counter("amslite_cloud_logins_total", "Cloud login attempts (WAN mode)", health.logins);
+  writer.counter("amslite_mqtt_messages_dropped_total", "Reports dropped because the main loop fell behind", health.messages_dropped);
+  writer.header("amslite_swap_loads_total", "counter", "Filament loads during swaps, by whether the lane started at the park point");
+  writer.value("amslite_swap_loads_total", "prestaged=\"0\"", bambu_swap_stats.loads[0]);
+  writer.value("amslite_swap_loads_total", "prestaged=\"1\"", bambu_swap_stats.loads[1]);
+  writer.header("amslite_swap_load_ms_total", "counter", "Time from push request to push complete, by whether the lane started at the park point");
+  writer.value("amslite_swap_load_ms_total", "prestaged=\"0\"", bambu_swap_stats.load_ms[0]);
+  writer.value("amslite_swap_load_ms_total", "prestaged=\"1\"", bambu_swap_stats.load_ms[1]);
+  writer.gauge("amslite_swap_last_load_ms", "Load time of the last swap", bambu_swap_stats.last_load_ms);
+  writer.gauge("amslite_swap_last_prestaged", "Whether the last swap loaded from the park point", bambu_swap_stats.last_prestaged);
+  writer.counter("amslite_actuator_sequences_cancelled_total", "Actuator sequences cancelled or replaced before finishing", actuator_timeline.m_cancelled);
+  writer.counter("amslite_config_writes_total", "Times config.json was written", app_config.m_writes);
+  writer.counter("amslite_config_unchanged_total", "Saves skipped because the content did not change", app_config.m_unchanged);
+  writer.counter("amslite_config_write_errors_total", "Failed writes of config.json", app_config.m_write_errors);
+  writer.gauge("amslite_journal_restored_records", "Lane journal records restored at boot", lane_journal.m_restored);
+  writer.gauge("amslite_journal_restore_us", "Time spent restoring the lane journal at boot", lane_journal.m_restore_us);
+  writer.counter("amslite_journal_corrupt_total", "Corrupt lane journal tails discarded at boot", lane_journal.m_corrupt);
+  writer.counter("amslite_journal_appends_total", "Batched appends to the lane journal", lane_journal.m_appends);
+  writer.counter("amslite_journal_records_total", "Records appended to the lane journal", lane_journal.m_records);
+  writer.counter("amslite_journal_compactions_total", "Lane journal compactions", lane_journal.m_compactions);
+  writer.counter("amslite_journal_write_errors_total", "Failed lane journal writes", lane_journal.m_write_errors);
+  writer.counter("amslite_sniffer_records_total", "Frames recorded by the bus sniffer", sniffer.m_records);
+  writer.counter("amslite_sniffer_overwritten_total", "Sniffer records overwritten before they were read", sniffer.m_overwritten);
+  writer.gauge("amslite_lanes_online", "Bitmask of lanes with filament present", ams_lite1.m_online);
+  writer.gauge("amslite_ws_clients", "Connected WebSocket clients", ws.count());
+  writer.counter("amslite_web_assets_sent_total", "Static web files sent in full", web_assets_sent);
+  writer.counter("amslite_web_assets_not_modified_total", "Static web requests answered with 304", web_assets_not_modified);
+  writer.gauge("amslite_heap_free_bytes", "Free heap", ESP.getFreeHeap());
+  writer.gauge("amslite_heap_largest_free_block_bytes", "Largest allocatable heap block", ESP.getMaxAllocHeap());
+  String body;
+  body.concat(writer.c_str(), writer.size());
+  request->send(request->beginResponse(200, "text/plain; version=0.0.4", body));
+}
+
 void restart(AsyncWebServerRequest* request) {
   request->send(200);
+  app_config.flush(true);
+  // 两者都持有各自的锁写完才返回，主循环正在写时也等它写完再重启
+  lane_journal.flush(millis(), true);
   ESP.restart();
 }
 
 
+// 等待 WiFi 连接的时间，超时后只保留热点
+#ifndef WIFI_CONNECT_TIMEOUT_MS
+#define WIFI_CONNECT_TIMEOUT_MS 14000
+#endif
+
+static bool s_wifi_connecting = false;
+static uint32_t s_wifi_begin = 0;
+
+enum {
+  BOOT_WIFI,
+  BOOT_TIME,
+  BOOT_MDNS,
+  BOOT_CLOUD,
+  BOOT_WEB,
+  BOOT_DONE,
+};
+static uint8_t s_boot_step = BOOT_WIFI;
+
 void wifi_setup() {
   WiFi.mode(WIFI_AP_STA);
   WiFi.softAP("zhaipro-amslite", "zhaipro-amslite");
-  if (!s_config.m_data["WiFi_ssid"].is<const char*>() || !s_config.m_data["WiFi_passphrase"].is<const char*>()) {
-    return;
-  }
-  const String& ssid = s_config.m_data["WiFi_ssid"];
-  const String& passphrase = s_config.m_data["WiFi_passphrase"];
+  app_config.lock();
+  String ssid = app_config.m_values.wifi_ssid;
+  String passphrase = app_config.m_values.wifi_passphrase;
+  app_config.unlock();
   if (ssid.isEmpty() || passphrase.isEmpty()) {
     return;
   }
-  // 最终常亮表示成功，常灭表示失败
   pinMode(LED_BUILTIN, OUTPUT);
-  Serial.printf("Connecting to %s ", ssid.c_str());
+  Serial.printf("Connecting to %s\n", ssid.c_str());
   WiFi.begin(ssid, passphrase);
-  for (int i = 0; i < 7; i++) {
-    digitalWrite(LED_BUILTIN, HIGH);  // turn the LED off by making the voltage LOW
-    if (WiFi.status() == WL_CONNECTED) {
-      break;
-    }
-    delay(1000);                      // wait for a second
-    digitalWrite(LED_BUILTIN, LOW);   // turn the LED on (HIGH is the voltage level)
-    delay(1000);                      // wait for a second
-    Serial.print(".");
+  s_wifi_connecting = true;
+  s_wifi_begin = millis();
+}
+
+// 连接中闪烁，最终常亮表示成功，常灭表示失败
+void wifi_poll(uint32_t now) {
+  if (!s_wifi_connecting) {
+    return;
   }
   if (WiFi.status() == WL_CONNECTED) {
-    Serial.println(" connected");
-    Serial.printf("IP: %s\n", WiFi.localIP().toString().c_str());
-  } else {
+    s_wifi_connecting = false;
+    digitalWrite(LED_BUILTIN, HIGH);
+    Serial.printf("WiFi connected, IP: %s\n", WiFi.localIP().toString().c_str());
+  } else if (now - s_wifi_begin >= WIFI_CONNECT_TIMEOUT_MS) {
+    s_wifi_connecting = false;
     WiFi.disconnect();
-    Serial.println(" failed");
+    digitalWrite(LED_BUILTIN, LOW);
+    Serial.println("WiFi connection failed");
+  } else {
+    digitalWrite(LED_BUILTIN, (now - s_wifi_begin) / 1000 % 2 == 0 ? HIGH : LOW);
   }
 }
 
-void bambu_callback(char* topic, byte* payload, unsigned int length) {
-  // https://arduinojson.org/v7/api/jsondocument/
-  JsonDocument data;
-  deserializeJson(data, payload, length);
-  if (!data["print"].is<JsonObject>()) {
-    // 收到未知信息，直接不理睬
-    return;
-  }
-
-  JsonDocument _data;
-  const char* sequence_id = data["print"]["sequence_id"];
-  if (data["print"]["hw_switch_state"].is<int>()) {
-    hw_switch_state = data["print"]["hw_switch_state"];
-    _data["hw_switch_state"] = hw_switch_state;
-  }
-  if (data["print"]["gcode_state"].is<const char*>()) {
-    gcode_state = data["print"]["gcode_state"].as<String>();
-    _data["gcode_state"] = gcode_state;
-  }
-  if (data["print"]["mc_percent"].is<int>()) {
-    mc_percent = data["print"]["mc_percent"];
-    _data["mc_percent"] = mc_percent;
-  }
-  if (gcode_state != "PAUSE") {
-    // 如果打印机不空闲，那么我必空闲
-    zp_state = 0;
-  } else if (mc_percent > 100 && zp_state == 0) {
-    zp_state = 1;
-    // 打印机处于暂停状态，且收到黑客请求，且处于空闲状态
-    next_extruder = mc_percent - 110;
-    if (hw_switch_state == -1) {
-      // 当前状态未知？？？error error error
-      return;
-    }
-    if (hw_switch_state == 0) {
-      // 无料，直接进料
-      bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_load);
-    } else if (next_extruder != previous_extruder) {
-      // 换料，先退料
-      bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_unload);
-    } else {
-      // 直接点完成吧
-      bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_resume);
-    }
-  }
-  if (data["print"]["ams_status"].is<int>()) {
-    ams_status = data["print"]["ams_status"];
-    _data["ams_status"] = ams_status;
-    Serial.printf("bambu sequence_id: \"%s\" ams_status: %d\n", sequence_id, ams_status);
-
-    if (ams_status == 260) {
-      // 请回抽
-      ams_lite1.backward(previous_extruder);
-    } if (ams_status == 261) {
-      // 请推入
-      ams_lite1.forward(next_extruder);
-    } else if (ams_status == 262) {
-      // 推入完成
-      ams_lite1.stop();
-    } else if (ams_status == 768) {
-      // 完成换料
-      previous_extruder = next_extruder;
-      if (zp_state == 1) {
-        bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_resume);
-      }
-    } else if (ams_status == 0) {
-      // 完成退料，但还要继续拔出一段
-      delay(1000);
-      ams_lite1.stop();
-      if (zp_state == 1) {
-        bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_load);
+// 联网相关的服务在主循环中每次启动一项，期间总线请求的电机动作照常执行
+void boot_poll() {
+  switch (s_boot_step) {
+    case BOOT_WIFI:
+      wifi_setup();
+      break;
+    case BOOT_TIME:
+      time_setup();
+      break;
+    case BOOT_MDNS: {
+      // Make it possible to access webserver at http://zhaipro-amslite.local
+      const char *hostname = "zhaipro-amslite";
+      if (!MDNS.begin(hostname)) {
+        Serial.println("Error setting up mDNS responder!");
+      } else {
+        Serial.printf("Access at http://%s.local\n", hostname);
       }
+      break;
     }
-    /*
-    0    空闲 or 完成退料？
-    258  加热中
-    259  裁剪耗材中
-    260  请回抽
-    261  请推入
-    262  检测到进料，hw_switch_state = 1
-    263  清理
-    768  完成换料 or 完成进料
-    1280 完成
-    */
-  }
-  
-  if (data["print"]["print_error"].is<int>()) {
-    print_error = data["print"]["print_error"];
-    _data["print_error"] = print_error;
-    Serial.printf("bambu sequence_id: \"%s\" print_error: %d\n", sequence_id, print_error);
-    // 318750726 0b1001011111111 11000000 00000110 请推入耗材？
-    // 318734342 0b1001011111111 11001110 00100110 没检测到进料？
-    // 318750723 0b1001011111111 11000000 00000011 请拔出耗材？
-    // 318734339 0b1001011111111 10000000 00000011 拔出耗材
-    // 318734343 0b1001011111111 10000000 00000111 是否完成换料？
-    if (print_error == 318734343) {
-      // 弹窗询问：“是否完成换料？”，我们点击完成
-      bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_done);
-    }
-  }
-  if (_data.size()) {
-    char buffer[256];
-    _data["sequence_id"] = sequence_id;
-    serializeJson(_data, buffer, sizeof(buffer));
-    ws.textAll(buffer);
+    case BOOT_CLOUD:
+#ifndef __DEBUG__
+      cloud_setup();
+      cloud_apply_config();
+#endif
+      break;
+    case BOOT_WEB:
+      wifi_server_setup();
+      Serial.printf("Boot finished %u ms after reset\n", (unsigned)millis());
+      break;
+    default:
+      return;
   }
-}
-
-void bambu_setup() {
-  // https://pubsubclient.knolleary.net/
-  wifi_client.setInsecure();
-  bambu_client.setCallback(bambu_callback);
-  bambu_client.setBufferSize(4096);   // 其默认值 256 太小啦
+  s_boot_step++;
 }
 
 void wifi_server_setup() {
@@ -510,640 +1029,252 @@ void wifi_server_setup() {
   server.on("/get_config", get_config);
   server.on("/get_local_ip", get_local_ip);
   server.on("/restart", restart);
+  server.on("/latency", get_latency);
+  server.on("/swaps", get_swaps);
+  server.on("/metrics", get_metrics);
+  server.on("/capture", get_capture);
+  ws.onEvent(on_ws_event);
   server.addHandler(&ws);
+  server.addHandler(&sniffer_ws);
   ElegantOTA.begin(&server);    // Start ElegantOTA
-  server.serveStatic("/", LittleFS, "/");
+  // 升级完成后会重启，先把还没写入的配置写下去
+  ElegantOTA.onStart([]() {
+    app_config.flush(true);
+    lane_journal.flush(millis(), true);
+  });
+  if (!web_assets_setup(server, LittleFS)) {
+    // 没有 tools/build_web.py 生成的清单（旧的文件系统镜像），照旧直接读取文件
+    server.serveStatic("/", LittleFS, "/");
+  }
   server.begin();
   Serial.println("HTTP server started");
 }
 
-CRC16 crc16(0x1021, 0x913D, 0, false, false);
-CRC8 crc8(0x39, 0x66, 0, false, false);
-
-#define RS485 Serial1
-#define RS485_RX_PIN  16
-#define RS485_TX_PIN  17
-#define RS485_RTS_PIN 4
-
-void setup() {
-  Serial.begin(115200);
-  RS485.begin(1228800, SERIAL_8E1, RS485_RX_PIN, RS485_TX_PIN);
-  if (!RS485.setPins(-1, -1, -1, RS485_RTS_PIN)) {
-    Serial.print("Failed to set RS485 pins");
+// 有 PSRAM 时用大一些的缓冲区
+void sniffer_setup() {
+  uint8_t *buffer = nullptr;
+  size_t capacity = SNIFFER_PSRAM_RING_SIZE;
+  if (psramFound()) {
+    buffer = (uint8_t*)ps_malloc(capacity);
   }
-
-  // Certain versions of Arduino core don't define MODE_RS485_HALF_DUPLEX and so fail to compile.
-  // By using UART_MODE_RS485_HALF_DUPLEX defined in hal/uart_types.h we work around this problem.
-  // If using a newer IDF and Arduino core you can omit including hal/uart_types.h and use MODE_RS485_HALF_DUPLEX
-  // defined in esp32-hal-uart.h (included during other build steps) instead.
-  if (!RS485.setMode(UART_MODE_RS485_HALF_DUPLEX)) {
-    Serial.print("Failed to set RS485 mode");
+  if (buffer == nullptr) {
+    capacity = SNIFFER_RING_SIZE;
+    buffer = (uint8_t*)malloc(capacity);
   }
-  // Serial.println(String(ESP.getEfuseMac(), HEX).c_str());
-  little_fs_setup();
-  s_config.setup();
-  wifi_setup();
-  time_setup();
-  // Make it possible to access webserver at http://zhaipro-amslite.local
-  const char *hostname = "zhaipro-amslite";
-  if (!MDNS.begin(hostname)) {
-    Serial.println("Error setting up mDNS responder!");
-  } else {
-    Serial.printf("Access at http://%s.local\n", hostname);
+  if (buffer) {
+    sniffer.begin(buffer, capacity);
   }
-#ifndef __DEBUG__
-  bambu_setup();
-#endif
-  wifi_server_setup();
-  ams_lite1.setup(12, 13, 27, 26, 14);
-  ams_lite1.m_servo_init = s_config.m_data["servo1_init"];
-  ams_lite1.m_servo_power = s_config.m_data["servo_power"];
 }
 
-typedef struct {
-  uint8_t head;         // 帧头 0x3D
-  uint8_t type;
-  union {
-    struct {            // type: 0x80
-      uint8_t size;
-      uint8_t rv;       // crc8
-      uint8_t cmd;
-      uint8_t data[1];
-    } body_80;
-    struct {            // type: 0x00
-      uint8_t temp2;
-      uint8_t temp3;
-      uint8_t size;     // 4
-      uint8_t temp5;
-      uint8_t rv;       // crc8
-      uint8_t cmd;      // 7
-      uint8_t data[1];
-    } body_00;
-  };
-} bambu_data_t;
-
-#include <assert.h>
-
-static_assert(sizeof(bambu_data_t) == 9, "");
-
-typedef struct {
-  uint8_t index;
-  uint8_t temp;
-  uint8_t id[8];
-  uint8_t r;
-  uint8_t g;
-  uint8_t b;
-  uint8_t a;
-  uint16_t temperature_min;
-  uint16_t temperature_max;
-  uint8_t name[20];   // 耗材的名称如：PLA
-} filament_t;
-static_assert(sizeof(filament_t) == 38);
-filament_t filaments[4];
-
-typedef struct {
-  int motion_set;
-  float meters;
-} filament_ex_t;
-filament_ex_t filaments_ex[4];
+void setup() {
+  Serial.begin(115200);
+  sniffer_setup();
+  protocol_setup();
+  // 先让打印机尽快看到 AMS：电机停在安全状态、恢复耗材设置、开始应答总线，
+  // WiFi、NTP、mDNS、MQTT 与网页由 boot_poll 在主循环中陆续启动
+  little_fs_setup();
+  app_config.setup();
+  config_apply();
+  app_config.lock();
+  ams_lite1.setup(app_config.m_values);
+  app_config.unlock();
+  lane_journal.restore();
+  bus_setup(protocol_on_frame);
+  // Serial.println(String(ESP.getEfuseMac(), HEX).c_str());
+  Serial.printf("Bus ready %u ms after reset\n", (unsigned)millis());
+}
 
-#pragma pack (1)
-typedef struct {
-  uint8_t head;         // 帧头 0x3D
-  uint8_t type;
-  union {
-    struct {            // type: 0x80
-      uint8_t size;
-      uint8_t rv;       // crc8
-      uint8_t cmd;
-      union {
-        filament_t filament;
-      } data;
-    } body_80;
-    struct {            // type: 0x00
-      uint8_t temp2;
-      uint8_t temp3;
-      uint8_t size;     // 4
-      uint8_t temp5;
-      uint8_t rv;       // crc8
-      uint8_t cmd;      // 7
-      uint8_t data[1];
-    } body_00;
-  };
-} bambu_data_ex_t;
-#pragma pack ()
-
-static_assert(sizeof(bambu_data_ex_t) == 43, "");
-
-void bambu_send(bambu_data_t *data) {
-  size_t size;
-  crc8.restart();
-  if (data->type & 0x80) {
-    crc8.add((uint8_t*)data, 3);
-    data->body_80.rv = crc8.calc();
-    size = data->body_80.size;
-  } else {
-    crc8.add((uint8_t*)data, 6);
-    data->body_00.rv = crc8.calc();
-    size = data->body_00.size;
-  }
-  crc16.restart();
-  crc16.add((uint8_t*)data, size - 2);
-  int rv = crc16.calc();
-  ((uint8_t*)data)[size - 2] = rv & 0xFF;
-  ((uint8_t*)data)[size - 1] = rv >> 8;
-  RS485.write((uint8_t*)data, size);
+void print_bus_frame(const bus_frame_t *frame) {
+  const bambu_data_t *bambu_data = (const bambu_data_t*)frame->data;
+  char text[sizeof(frame->data) * 2 + 20];
+  const char *prefix = (bambu_data->type == 0x05 && bambu_data->body_00.data[0] == 0x12) ? "<= " : "";
+  int n = snprintf(text, sizeof(text), "{\"ams\": \"%s", prefix);
+  bambu_to_hex(frame->data, frame->size, text + n);
+  n += frame->size * 2;
+  n += snprintf(text + n, sizeof(text) - n, "\"}");
+  ws_send_all(text, n);
 }
 
-bool bambu_check(const bambu_data_t *data) {
-  size_t size;
-  crc8.restart();
-  if (data->type & 0x80) {
-    crc8.add((uint8_t*)data, 3);
-    if (data->body_80.rv != crc8.calc()) {
-      return false;
-    }
-    size = data->body_80.size;
-  } else {
-    crc8.add((uint8_t*)data, 6);
-    if (data->body_00.rv != crc8.calc()) {
-      return false;
+// 总线任务不能等串口，帧的日志在这里打印
+void log_bus_frame(const bus_frame_t *frame) {
+  const bambu_data_t *data = (const bambu_data_t*)frame->data;
+  if (data->type == 0xc5) {
+    uint8_t cmd = data->body_80.cmd;
+    if (cmd == 0x08) {
+      char hex[sizeof(frame->data) * 2 + 1];
+      bambu_to_hex(frame->data, frame->size, hex);
+      Serial.printf("打印机告诉我们耗材类型: %s\n", hex);
+    } else if (cmd == 0x07) {
+      Serial.println("NFC detect");
+    } else if (cmd == 0x03 || cmd == 0x04) {
+      // 两种查询中 motion 与 read_num 的位置不同
+      static int last_motion = -1;
+      uint8_t motion = 0;
+      uint8_t read_num = 0;
+      const bambu_get_meters_t *meters = cmd == 0x03 ? bambu_view<bambu_get_meters_t>(data) : nullptr;
+      const bambu_get_status_t *status = cmd == 0x04 ? bambu_view<bambu_get_status_t>(data) : nullptr;
+      if (meters) {
+        motion = meters->motion;
+        read_num = meters->read_num;
+      } else if (status) {
+        motion = status->motion;
+        read_num = status->read_num;
+      } else {
+        return;
+      }
+      if (motion != last_motion && read_num < 4) {
+        last_motion = motion;
+        Serial.printf("motion fliment: %d, motion_flag: %x meters: %f\n", read_num, motion, filaments_ex[read_num].meters);
+      }
     }
-    size = data->body_00.size;
+  } else if (data->type == 0x05 && data->body_00.data[2] == 0x06) {
+    Serial.println("打印机询问我们耗材类型");
   }
-  crc16.restart();
-  crc16.add((uint8_t*)data, size - 2);
-  int rv = crc16.calc();
-  return ((uint8_t*)data)[size - 2] == (rv & 0xFF) && ((uint8_t*)data)[size - 1] == (rv >> 8);
 }
 
-typedef struct {
-  uint8_t head;         // 帧头 0x3D
-  uint8_t type;
-  uint8_t temp2;
-  uint8_t temp3;
-  uint8_t size;     // 4
-  uint8_t temp5;
-  uint8_t rv;       // crc8
-  uint8_t cmd;      // 7
-  uint8_t temp8;
-  uint8_t temp9;
-  uint8_t temp10;
-  uint8_t temp11;
-  uint8_t temp12;
-  uint8_t temp13;
-  uint8_t index;    // 第几个
-  uint8_t data[1];
-} bambu_data__t;
-
-uint8_t X05_MC_AP_Read_filament_res[] = {
-        0x3D, 0x00, 0x00, 0x00, 0x92, 0x00, 0x2B, 0x00,
-        0x06, 0x00, 0x12, 0x11, 0x02, 0x00, 0x02, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x47, 0x46, 0x47, 0x39, 0x39, 0x00, 0x00, 0x00,   // id
-        0x50, 0x45, 0x54, 0x47, 0x00, 0x00, 0x00, 0x00,   // name：PETG
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x16, 0x16, 0x16, 0xFF, 0x00, 0x00, 0x00, 0x00,   // 颜色
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x0E, 0x01, 0xE6, 0x00,   // 温度：[230, 270]
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00};
-void on_get_filament(const bambu_data_t *data)
-{
-  // x - 8
-  if (data->body_00.data[3] == 0x11) {
-    uint8_t n = data->body_00.data[6];
-    X05_MC_AP_Read_filament_res[14] = n;
-    // [14, 15)
-    X05_MC_AP_Read_filament_res[72] = filaments[n].r;
-    X05_MC_AP_Read_filament_res[73] = filaments[n].g;
-    X05_MC_AP_Read_filament_res[74] = filaments[n].b;
-    X05_MC_AP_Read_filament_res[75] = filaments[n].a;
-    // [72, 76)
-
-    memcpy(X05_MC_AP_Read_filament_res + 32, filaments[n].id, sizeof(filaments[n].id));
-    memcpy(X05_MC_AP_Read_filament_res + 40, filaments[n].name, sizeof(filaments[n].name));
-    // [32, 60)
-    memcpy(X05_MC_AP_Read_filament_res + 92, &filaments[n].temperature_min, sizeof(filaments[n].temperature_min));
-    memcpy(X05_MC_AP_Read_filament_res + 94, &filaments[n].temperature_max, sizeof(filaments[n].temperature_max));
-    // [92, 96)
-    bambu_send((bambu_data_t*)X05_MC_AP_Read_filament_res);
+// 把新的抓包记录推给 /sniffer 的网页；没有网页连着时跳过积压的记录
+void sniffer_flush() {
+  static uint32_t cursor = 0;
+  if (sniffer_ws.count() == 0) {
+    cursor = sniffer.head();
+    return;
   }
-}
-
-void on_set_filament(bambu_data_ex_t *data) {
-  filaments[data->body_80.data.filament.index] = data->body_80.data.filament;
-  uint8_t restuls[0x08]{0x3D, 0xC0, 0x08, 0xB2, 0x08, 0x60};
-  bambu_send((bambu_data_t*)restuls);
-}
-
-#define C_test 0x00, 0x00, 0x00, 0xFF, \
-               0x00, 0x00, 0x80, 0xBF, \
-               0x00, 0x00, 0x00, 0xC0, \
-               0x00, 0xC0, 0x5D, 0xFF, \
-               0xFC, 0xFF, 0xFC, 0xFF, \
-               0x00, 0x00, 0x44, 0x00, \
-               0x55,                   \
-               0xC1, 0xC3, 0xEC, 0xBC, \
-               0x01, 0x01, 0x01, 0x01,
-unsigned char Dxx_res[] = {0x3D, 0xE0, 0x3C, 0x1A, 0x04,
-                           0x00, 0x00, 0x00, 0x00,
-                           0x04, 0x04, 0x04, 0xFF, // flags
-                           0x00, 0x00, 0x00, 0x00,
-                           C_test 0x00, 0x00, 0x00, 0x00,
-                           0x64, 0x64, 0x64, 0x64,
-                           0x90, 0xE4};
-uint8_t packge_num = 0;
-
-
-
-int now_filament_num = -1;
-int last_time = 0;
-int now_fliment_motion_flag = -1;
-unsigned char Cxx_res[] = {0x3D, 0xE0, 0x2C, 0x1A, 0x03,
-                           C_test 0x00, 0x00, 0x00, 0x00,
-                           0x90, 0xE4};
-void on_get_meters(const bambu_data_ex_t *data) {
-  const uint8_t *buf = (const uint8_t*)data;
-  Cxx_res[1] = 0xC0 | (packge_num << 3);
-
-  uint8_t read_num = buf[7];
-  unsigned char fliment_motion_flag = buf[8];
-  float meters = -1;
-  if (read_num < 4) {
-    filaments_ex[read_num].motion_set = fliment_motion_flag;
-    if (read_num != now_filament_num || now_fliment_motion_flag != fliment_motion_flag) {
-      now_fliment_motion_flag = fliment_motion_flag;
-      Serial.printf("on_get_meters fliment: %d, motion_flag: %x meters: %f\n", read_num, fliment_motion_flag, filaments_ex[read_num].meters);
-    }
-    int now_time =  millis();
-    if (read_num != now_filament_num) {
-      now_filament_num = read_num;
-      filaments_ex[read_num].meters = 0;
-      last_time = now_time;
+  static uint8_t buffer[SNIFFER_WS_MESSAGE_SIZE];
+  size_t n = sniffer.read(&cursor, buffer, sizeof(buffer));
+  if (n == 0) {
+    return;
+  }
+  AsyncWebSocketSharedBuffer shared = std::make_shared<std::vector<uint8_t>>(buffer, buffer + n);
+  for (AsyncWebSocketClient &client : sniffer_ws.getClients()) {
+    if (client.status() != WS_CONNECTED) {
+      continue;
     }
-    if (fliment_motion_flag == 0x3f) {        // 请求退料
-      filaments_ex[read_num].meters -= (now_time - last_time) / 1000.0 * 5.0;
-      if (read_num == 0) {
-        ams_lite1.backward(0);
-      }
-    } else if (fliment_motion_flag == 0xbf) { // 请求进料
-      if (read_num == 0) {
-        ams_lite1.forward(0);
-      }
-      // filaments_ex[read_num].meters += (now_time - last_time) / 1000.0 * 5.0;
-    } else {
-      if (read_num == 0) {
-        ams_lite1.stop();
-      }
+    if (client.queueIsFull()) {
+      metrics.ws_dropped++;
+      continue;
     }
-    meters = filaments_ex[read_num].meters;
-    last_time = now_time;
+    client.binary(shared);
   }
-  uint8_t flagx = 0x02;
-  Cxx_res[7] = flagx;
-  Cxx_res[8] = read_num;
-  memcpy(Cxx_res + 9, &meters, sizeof(meters));
-
-  bambu_send((bambu_data_t*)Cxx_res);
-  packge_num = (packge_num + 1) % 8;
 }
 
+// 每隔 s_ws_interval_ms 推送一次：状态的增量（错过增量的网页收到完整快照），
+// 以及这段时间内最后一个总线帧
+void ws_flush() {
+  // 每次循环都取空队列，免得总线帧在两次推送之间把队列占满；只留下最后一个
+  static bus_frame_t frame;
+  static bool has_frame = false;
+  static bus_frame_t next;
+  while (bus_receive_frame(&next)) {
+    log_bus_frame(&next);
+    if (has_frame) {
+      metrics.ws_coalesced++;
+    }
+    frame = next;
+    has_frame = true;
+  }
 
-void on_get_status(const bambu_data_t *data) {
-  unsigned char filament_flag_on = 0x00;
-  unsigned char filament_flag_NFC = 0x00;
-  unsigned char fliment_motion_flag = data->body_80.data[2];
-  unsigned char read_num = data->body_80.data[4];
-  float meters = -1;
-  uint8_t flagx=0x02;
-
-  filament_flag_on = 0x0f;  // 四个都在线
+  static uint32_t last_flush = 0;
+  uint32_t now = millis();
+  if (now - last_flush < s_ws_interval_ms) {
+    return;
+  }
+  last_flush = now;
+  ws.cleanupClients();
+  sniffer_ws.cleanupClients();
 
-  if (read_num < 4) {
-    filaments_ex[read_num].motion_set = fliment_motion_flag;
-    now_filament_num = read_num;
-    if (read_num != now_filament_num || now_fliment_motion_flag != fliment_motion_flag) {
-      now_fliment_motion_flag = fliment_motion_flag;
+  if (has_frame) {
+    print_bus_frame(&frame);
+    has_frame = false;
+  }
 
-      Serial.printf("on_get_status fliment: %d, motion_flag: %x meters: %d\n", read_num, fliment_motion_flag, filaments_ex[read_num].meters);
-    }
-    int now_time =  millis();
-    if (read_num != now_filament_num) {
-      now_filament_num = read_num;
-      filaments_ex[read_num].meters = 0;
-      last_time = now_time;
+  if (!web_state.dirty() && s_ws_stale_count == 0) {
+    return;
+  }
+  char text[256];
+  size_t n = web_state.render(text, sizeof(text), false);
+  AsyncWebSocketSharedBuffer delta = n ? ws_buffer(text, n) : nullptr;
+  n = web_state.render(text, sizeof(text), true);
+  AsyncWebSocketSharedBuffer full = n ? ws_buffer(text, n) : nullptr;
+  web_state.clear_dirty();
+  for (AsyncWebSocketClient &client : ws.getClients()) {
+    bool stale = ws_is_stale(client.id());
+    const AsyncWebSocketSharedBuffer &buffer = stale ? full : delta;
+    if (!buffer) {
+      continue;
     }
-    if (fliment_motion_flag == 0x3f) {        // 请求退料
-      filaments_ex[read_num].meters -= (now_time - last_time) / 1000.0 * 5.0;
-      if (read_num == 0) {
-        ams_lite1.backward(0);
-      }
-    } else if (fliment_motion_flag == 0xbf) { // 请求进料
-      // filaments_ex[read_num].meters += (now_time - last_time) / 1000.0 * 5.0;
-      if (read_num == 0) {
-        ams_lite1.forward(0);
-      }
-    } else {
-      if (read_num == 0) {
-        ams_lite1.stop();
+    if (ws_send(client, buffer)) {
+      if (stale) {
+        ws_mark_stale(client.id(), false);
       }
+    } else if (client.status() == WS_CONNECTED) {
+      ws_mark_stale(client.id(), true);
     }
-    meters = filaments_ex[read_num].meters;
-    last_time = now_time;
-  }
-
-  Dxx_res[1] = 0xC0 | (packge_num << 3);
-  Dxx_res[9] = filament_flag_on;
-  Dxx_res[10] = filament_flag_on - filament_flag_NFC;
-  Dxx_res[11] = filament_flag_on - filament_flag_NFC;
-  Dxx_res[19] = flagx;
-  Dxx_res[20] = Dxx_res[12] = read_num;
-  Dxx_res[13] = filament_flag_NFC;
-  memcpy(Dxx_res + 21, &meters, sizeof(meters));
-  bambu_send((bambu_data_t*)Dxx_res);
-  packge_num = (packge_num + 1) % 8;
-}
-
-unsigned char NFC_detect_res[] = {0x3D, 0xC0, 0x0D, 0x6F, 0x07, 0x00, 0x03, 0x01, 0x00, 0x00, 0x00, 0xFC, 0xE8};
-void on_NFC_detect(bambu_data_ex_t *data) {
-  uint8_t *buf = (uint8_t*)data;
-  NFC_detect_res[6] = buf[6];
-  NFC_detect_res[7] = buf[7];
-  bambu_send((bambu_data_t*)NFC_detect_res);
-}
-
-
-unsigned char X05_AP2_res_03[] = {0x3D, 0x00, 0x6A, 0x00, 0x48, 0x00, 0xC0, 0x00,
-                                  0x09, 0x00, 0x12, 0x03, 0x01,
-                                  92, 07, 00, 00,                                             // 我们伪装(AMS Lite)的版本: 00.00.07.92
-                                        0x41, 0x4D, 0x53, 0x5F, 0x46, 0x31, 0x30,
-                                  0x32, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xBD, 0x44};
-unsigned char X05_AP2_res_02[] = {0x3D, 0x00, 0xB3, 0x00, 0x51, 0x00, 0x28, 0x00,
-                                  0x09, 0x00, 0x12, 0x02, 0x04, 0x0F,
-  0x30, 0x33, 0x43, 0x31, 0x32, 0x41, 0x33, 0x43, 0x30, 0x34, 0x30, 0x30, 0x35, 0x32, 0x39,   // 我们伪装(AMS Lite)的序列号: 03C12A3C0400529
-                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-                                  0x00, 0x9B, 0x31, 0x33, 0x34, 0x36, 0x35, 0x02,
-                                  0x00, 0x37, 0x39, 0x33, 0x38, 0xFF, 0xFF, 0xFF,
-                                  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-                                  0xFF, 0xBB, 0x44, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
-                                  0xFF, 0x00, 0xDE, 0xEF};
-void on_get_version(const bambu_data_t *data) {
-  if (data->body_00.data[3] == 0x02) {
-    // 硬件序列号
-    X05_AP2_res_02[2] = data->body_00.temp2;
-    bambu_send((bambu_data_t*)X05_AP2_res_02);
-  } else if (data->body_00.data[3] == 0x03) {
-    // 固件版本
-    X05_AP2_res_03[2] = data->body_00.temp2;
-    bambu_send((bambu_data_t*)X05_AP2_res_03);
   }
 }
 
-unsigned char X05_MC_res[] = {0x3D, 0x00, 0x00, 0x00, 0x15,
-                              0x00, 0xF4, 0x00, 0x03, 0x00, 0x12, 0x1A, 0x02,
-                              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x57};
-void send_for_X05_MC() {
-    bambu_send((bambu_data_t*)X05_MC_res);
-}
-
-unsigned char REQx6_res[] = {0x3D, 0xE0, 0x3C, 0x1A, 0x06,
-                             0x00, 0x00, 0x00, 0x00,
-                             0x04, 0x04, 0x04, 0xFF, // flags
-                             0x00, 0x00, 0x00, 0x00,
-                             C_test 0x00, 0x00, 0x00, 0x00,
-                             0x64, 0x64, 0x64, 0x64,
-                             0x90, 0xE4};
-
-/*
-void send_for_REQx6(unsigned char *buf) {
-    unsigned char filament_flag_on = 0x00;
-    unsigned char filament_flag_NFC = 0x00;
-    for (int i = 0; i < 4; i++)
-    {
-        filaments[i].meters;
-        if (filament[i].statu == online)
-        {
-            filament_flag_on |= 1 << i;
-        }
-        else if (filament[i].statu == NFC_waiting)
-        {
-            filament_flag_on |= 1 << i;
-            filament_flag_NFC |= 1 << i;
-        }
-    }
-    REQx6_res[1] = 0xC0 | (packge_num << 3);
-    res_for_06_num = buf[7];
-    REQx6_res[9] = filament_flag_on;
-    REQx6_res[10] = filament_flag_on - filament_flag_NFC;
-    REQx6_res[11] = filament_flag_on - filament_flag_NFC;
-    Dxx_res2[12] = res_for_06_num;
-    Dxx_res2[12] = res_for_06_num;
-    packge_send_with_crc(REQx6_res, sizeof(REQx6_res));
-    need_res_for_06 = true;
-    packge_num = (packge_num + 1) % 8;
-}
-*/
-
-void on_online_detection(const bambu_data_t *data) {
-  if (data->body_80.data[0] == 0x01 && data->body_80.data[1] == 0x00) {
-    uint8_t restuls[0x1d]{0x3d, 0xc0, 0x1d, 0xb4, 0x05, 0x01, 0x00};
-    bambu_send((bambu_data_t*)restuls);
+// 处理 cloud 任务收到的 report，保存登录结果，连接失败时提示网页
+void cloud_flush() {
+  cloud_dispatch();
+  String username;
+  String access_token;
+  if (cloud_take_login(&username, &access_token)) {
+    app_config.lock();
+    app_config.m_values.username = username;
+    app_config.m_values.access_token = access_token;
+    app_config.save();
+    app_config.unlock();
   }
-}
-
-void print_bambu_data(const char *fmt, const bambu_data_t *data) {
-  String hex;
-  for(int i = 0; i < data->body_80.size; i++) {
-    uint8_t c2 = ((uint8_t*)data)[i];
-    uint8_t c1 = c2 >> 4;
-    c2 = c2 & 0x0f;
-    hex += String(c1, HEX);
-    hex += String(c2, HEX);
+  static uint32_t failures = 0;
+  cloud_health_t health;
+  cloud_health(&health);
+  if (health.failures != failures) {
+    failures = health.failures;
+    app_config.lock();
+    String mode = app_config.m_values.mode;
+    app_config.unlock();
+    ws_message("The bambu connection(%s) failed! state: %d, %s", mode.c_str(),
+               (int)health.last_error, cloud_state_name(health.state));
   }
-  Serial.printf(fmt, hex.c_str());
 }
 
 void loop() {
+  uint32_t loop_begin = micros();
   ElegantOTA.loop();
-  static int count = 0;
   if (Serial.available()) {
     String s = Serial.readString();
     s.replace("\n", "");
-    ws.printfAll("{\"message\": \"%s\"}", s.c_str());
-  }
-  static uint8_t buffer[256];
-  static size_t end = 0;
-  if (RS485.available()) {
-    end = RS485.readBytes(buffer + end, 256 - end) + end;
-    int i = 0;
-    for (; i < end; i++) {
-      if (buffer[i] == 0x3d) {
-        break;
-      }
-    }
-    if (i == end) {
-      end = 0;
-    } else if (i > 0) {
-      memcpy(buffer, buffer + i, end - i);
-      end = end - i;
-    }
-    bambu_data_t *bambu_data = (bambu_data_t*)buffer;
-    if (end >= 5) {
-      if (bambu_data->type == 0xc5) {
-        if (end >= bambu_data->body_80.size) {
-          // 0x20 是心跳信号，可以忽略啦
-          if (bambu_data->body_80.cmd != 0x20 && count > 32) {
-            // 频繁打印web传输不过来
-            count = 0;
-            String string_to_hex;
-            for(int i = 0; i < bambu_data->body_80.size; i++) {
-              uint8_t c2 = ((uint8_t*)bambu_data)[i];
-              uint8_t c1 = c2 >> 4;
-              c2 = c2 & 0x0f;
-              string_to_hex += String(c1, HEX);
-              string_to_hex += String(c2, HEX);
-            }
-            ws.printfAll("{\"ams\": \"%s\"}", string_to_hex.c_str());
-          }
-          if (bambu_data->body_80.cmd == 0x05) {
-            on_online_detection(bambu_data);
-          }
-          // 打印机询问我们状态
-          if (bambu_data->body_80.cmd == 0x04) {
-            on_get_status(bambu_data);
-          }
-          // 打印机告诉我们耗材类型
-          bambu_data_ex_t *bambu_data_ex = (bambu_data_ex_t*)bambu_data;
-          if (bambu_data->body_80.cmd == 0x08) {
-            print_bambu_data("打印机告诉我们耗材类型: %s\n", bambu_data);
-            on_set_filament(bambu_data_ex);
-          }
-          if (bambu_data_ex->body_80.cmd == 0x07) {
-            Serial.println("NFC detect");
-            // on_NFC_detect(bambu_data_ex);
-          }
-          if (bambu_data_ex->body_80.cmd == 0x03) {
-            on_get_meters(bambu_data_ex);
-          }
-          if (bambu_data_ex->body_80.cmd == 0x06) {
-            Serial.println("cmd 0x06");
-          }
-          end = end - bambu_data->body_80.size;
-          memcpy(buffer, buffer + bambu_data->body_80.size, end);
-        }
-      } else if (bambu_data->type == 0x05) {
-        if (end >= bambu_data->body_00.size) {
-          String string_to_hex;
-          for(int i = 0; i < bambu_data->body_00.size; i++) {
-            uint8_t c2 = ((uint8_t*)bambu_data)[i];
-            uint8_t c1 = c2 >> 4;
-            c2 = c2 & 0x0f;
-            string_to_hex += String(c1, HEX);
-            string_to_hex += String(c2, HEX);
-          }
-          if (bambu_data->body_00.data[0] == 0x12) {
-            ws.printfAll("{\"ams\": \"<= %s\"}", string_to_hex.c_str());
-            if (bambu_data->body_00.data[2] == 0x09) {
-              on_get_version(bambu_data);
-            } else if (bambu_data->body_00.data[2] == 0x06) {
-              Serial.println("打印机询问我们耗材类型");
-              on_get_filament(bambu_data);
-            } else if (bambu_data->body_00.data[2] == 0x03) {
-              // Serial.println("我不知道这是什么");
-              // send_for_X05_MC();
-            }
-          } else {
-            ws.printfAll("{\"ams\": \"%s\"}", string_to_hex.c_str());
-          }
-          end = end - bambu_data->body_00.size;
-          memcpy(buffer, buffer + bambu_data->body_00.size, end);
-        }
-      } else {
-        // Serial.printf("来自打印机的未知命令: %d\n", bambu_data->type);
-      }
-    }
+    ws_message("%s", s.c_str());
   }
-#ifndef __DEBUG__
-  if (WiFi.status() == WL_CONNECTED && !bambu_client.connected()) {
-    if (s_config.m_data["mode"] == "WAN") {
-      const char* bambu_mqtt_id = "mqttx_c59bbf21";
-      const char* username = s_config.m_data["username"];
-      const char* access_token = s_config.m_data["access_token"];
-      if (username && access_token) {
-        Serial.printf("bambu_client.connect(<id>, \"%s\", <token>)\n", username);
-        bambu_client.setServer("cn.mqtt.bambulab.com", 8883);
-        if (bambu_client.connect(bambu_mqtt_id, username, access_token)) {
-          Serial.println("Connecting to bambu .. connected!");
-          bambu_client.subscribe(s_config.m_data["bambu_topic_subscribe"]);
-          bambu_client.publish(s_config.m_data["bambu_topic_publish"], bambu_pushall);
-        } else {
-          Serial.printf("The bambu connection(WAN) failed!\nbambu_client.state() => %d\n", bambu_client.state());
-          s_config.m_data.remove("username");
-          s_config.m_data.remove("access_token");
-        }
-      } else {
-        const String& phone_number = s_config.m_data["phone_number"].as<String>();
-        const String& password = s_config.m_data["password"].as<String>();
-        if (!phone_number.isEmpty() && !password.isEmpty()) {
-          HTTPClient http;
-          JsonDocument data;
-          char buffer[256];
-          http.begin("https://api.bambulab.cn/v1/user-service/user/login");
-          http.addHeader("Content-Type", "application/json");
-          data["account"] = phone_number;
-          data["password"] = password;
-          serializeJson(data, buffer, 256);
-          Serial.printf("[HTTP] POST: %s\n", buffer);
-          int code = http.POST(buffer);
-          if (code == HTTP_CODE_OK) {
-            deserializeJson(data, http.getString());
-            s_config.m_data["access_token"] = data["accessToken"].as<String>();
-            const char* jwt = data["accessToken"].as<const char*>();
-            const char* sep = ".";
-            strtok((char*)jwt, sep);
-            char* encoded_payload = strtok(NULL, sep);
-            uint8_t payload[base64::decodeLength(encoded_payload)];
-            base64::decode(encoded_payload, payload);
-            deserializeJson(data, payload);
-            s_config.m_data["username"] = data["username"].as<String>();
-            Serial.printf("username: %s\n", data["username"].as<const char*>());
-            s_config.save();
-          } else {
-            Serial.printf("[HTTP] GET... code: %d\n%s", code, http.getString().c_str());
-            s_config.m_data["mode"] = "";
-          }
-        }
-      }
-    } else if (s_config.m_data["mode"] == "LAN") {
-      const char* bambu_mqtt_id = "mqttx_c59bbf21";
-      const char* bambu_mqtt_user = "bblp";
-      bambu_client.setServer(s_config.m_data["bambu_mqtt_broker"].as<const char*>(), 8883);
-      if (bambu_client.connect(bambu_mqtt_id, bambu_mqtt_user, s_config.m_data["bambu_mqtt_password"].as<const char*>())) {
-        Serial.println("Connecting to bambu .. connected!");
-        bambu_client.subscribe(s_config.m_data["bambu_topic_subscribe"].as<const char*>());
-        bambu_client.publish(s_config.m_data["bambu_topic_publish"].as<const char*>(), bambu_pushall);
-      } else {
-        ws.printfAll("{\"message\": \"The bambu connection(LAN) failed! state: %d\"}", bambu_client.state());
-        Serial.printf("The bambu connection(LAN) failed! state: %d\n", bambu_client.state());
-        s_config.m_data["mode"] = "";
-      }
+  // 执行总线上请求的电机动作
+  bus_actuator_t actuator;
+  while (bus_receive_actuator(&actuator)) {
+    if (actuator.action == ACTUATOR_STOP && bambu_prestaging(actuator.lane, millis())) {
+      continue;
     }
+    hal_actuator(actuator.action, actuator.lane);
+  }
+  if (receive_web_actuator(&actuator)) {
+    hal_actuator(actuator.action, actuator.lane);
+  }
+  actuator_timeline.poll(millis());
+  ams_lite1.update(millis());
+  sniffer_flush();
+  ws_flush();
+  app_config.flush();
+  lane_journal.flush(millis());
+  boot_poll();
+  wifi_poll(millis());
+  time_poll();
+  static bool first_reply_logged = false;
+  if (!first_reply_logged && metrics.first_reply_us) {
+    first_reply_logged = true;
+    Serial.printf("First bus reply %u ms after reset\n", (unsigned)(metrics.first_reply_us / 1000));
   }
-  bambu_client.loop();
+#ifndef __DEBUG__
+  cloud_flush();
 #endif
+  metrics.loop_us = micros() - loop_begin;
+  if (metrics.loop_us > metrics.loop_max_us) {
+    metrics.loop_max_us = metrics.loop_us;
+  }
 }
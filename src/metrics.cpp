@@ -0,0 +1,85 @@
+#include "metrics.h"
+#include "dispatch.h"
+#include "web_state.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+metrics_t metrics;
+
+void metrics_count_frame(const bambu_data_t *data) {
+  uint8_t cmd = (data->type & 0x80) ? data->body_80.cmd : data->body_00.data[2];
+  for (int i = 0; i < METRICS_FRAME_KINDS; i++) {
+    metrics_frame_t &frame = metrics.frames[i];
+    if (frame.count == 0) {
+      frame.type = data->type;
+      frame.cmd = cmd;
+    }
+    if (frame.type == data->type && frame.cmd == cmd) {
+      frame.count++;
+      return;
+    }
+  }
+  metrics.frames_other++;
+}
+
+void MetricsWriter::printf(const char *fmt, ...) {
+  if (m_size + 1 >= m_capacity) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(m_buffer + m_size, m_capacity - m_size, fmt, args);
+  va_end(args);
+  if (n > 0) {
+    m_size += n;
+    if (m_size >= m_capacity) {
+      m_size = m_capacity - 1;
+    }
+  }
+}
+
+void MetricsWriter::header(const char *name, const char *type, const char *help) {
+  printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void MetricsWriter::value(const char *name, uint32_t value) {
+  printf("%s %u\n", name, (unsigned)value);
+}
+
+void MetricsWriter::value(const char *name, const char *labels, uint32_t value) {
+  printf("%s{%s} %u\n", name, labels, (unsigned)value);
+}
+
+void MetricsWriter::gauge(const char *name, const char *help, uint32_t value) {
+  header(name, "gauge", help);
+  this->value(name, value);
+}
+
+void MetricsWriter::counter(const char *name, const char *help, uint32_t value) {
+  header(name, "counter", help);
+  this->value(name, value);
+}
+
+void metrics_render(MetricsWriter &writer) {
+  writer.header("amslite_bus_frames_total", "counter", "Frames received, by type and cmd (sub-command for type 05)");
+  for (int i = 0; i < METRICS_FRAME_KINDS && metrics.frames[i].count; i++) {
+    char labels[32];
+    snprintf(labels, sizeof(labels), "type=\"%02x\",cmd=\"%02x\"", metrics.frames[i].type, metrics.frames[i].cmd);
+    writer.value("amslite_bus_frames_total", labels, metrics.frames[i].count);
+  }
+  writer.value("amslite_bus_frames_total", "type=\"other\",cmd=\"other\"", metrics.frames_other);
+  writer.counter("amslite_bus_frames_rejected_total", "Frames too short for their command, dropped before the handler", metrics.frames_rejected);
+  writer.counter("amslite_bus_frames_unknown_total", "Frames with no registered handler", dispatch_unknown);
+  writer.counter("amslite_bus_replies_total", "Replies sent on the bus", metrics.replies);
+  writer.counter("amslite_mqtt_messages_total", "MQTT reports handled", metrics.mqtt_messages);
+  writer.counter("amslite_mqtt_parsed_bytes_total", "Bytes of MQTT reports parsed", metrics.mqtt_bytes);
+  writer.counter("amslite_mqtt_parse_errors_total", "MQTT reports that failed to parse, including arena overflow", metrics.mqtt_parse_errors);
+  writer.counter("amslite_mqtt_connects_total", "MQTT connection attempts", metrics.mqtt_connects);
+  writer.counter("amslite_mqtt_connect_failures_total", "MQTT connection failures", metrics.mqtt_connect_failures);
+  writer.counter("amslite_ws_dropped_total", "WebSocket messages skipped for clients with a full queue", metrics.ws_dropped);
+  writer.counter("amslite_ws_frames_coalesced_total", "Monitored bus frames replaced by a later one within a push interval", metrics.ws_coalesced);
+  writer.counter("amslite_ws_state_coalesced_total", "State updates replaced by a later value within a push interval", web_state.m_coalesced);
+  writer.gauge("amslite_loop_us", "Duration of the last loop() iteration", metrics.loop_us);
+  writer.gauge("amslite_loop_max_us", "Longest loop() iteration since the last scrape", metrics.loop_max_us);
+  writer.gauge("amslite_first_reply_us", "Time from reset to the first bus reply", metrics.first_reply_us);
+}
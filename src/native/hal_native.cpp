@@ -0,0 +1,93 @@
+#include "hal.h"
+#include <chrono>
+#include <mutex>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "native.h"
+
+std::vector<std::vector<uint8_t>> native_uart_writes;
+int native_actuator_action = -1;
+int native_actuator_lane = -1;
+uint32_t native_actuator_count = 0;
+uint32_t native_publish_count = 0;
+bool native_verbose = true;
+bool native_odometer = false;
+float native_odometer_meters[4];
+uint8_t native_lanes_online = 0x0f;
+uint8_t native_lanes_nfc = 0;
+
+static const auto s_boot = std::chrono::steady_clock::now();
+
+uint32_t hal_millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - s_boot).count();
+}
+
+uint32_t hal_micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_boot).count();
+}
+
+uint32_t hal_cycles() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_boot).count();
+}
+
+uint32_t hal_cycles_per_us() {
+  return 1000;
+}
+
+static std::mutex s_critical;
+
+void hal_critical_enter() {
+  s_critical.lock();
+}
+
+void hal_critical_exit() {
+  s_critical.unlock();
+}
+
+void hal_log(const char *fmt, ...) {
+  if (!native_verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+}
+
+void hal_uart_write(const uint8_t *data, size_t size) {
+  native_uart_writes.emplace_back(data, data + size);
+}
+
+bool hal_feed_meters(uint8_t lane, float *meters) {
+  if (!native_odometer || lane >= 4) {
+    return false;
+  }
+  *meters = native_odometer_meters[lane];
+  return true;
+}
+
+void hal_lane_flags(uint8_t *online, uint8_t *nfc) {
+  *online = native_lanes_online;
+  *nfc = native_lanes_nfc;
+}
+
+void hal_bus_actuator(uint8_t action, uint8_t lane) {
+  hal_actuator(action, lane);
+}
+
+void hal_monitor_frame(const bambu_data_t *data) {
+  (void)data;
+}
+
+void hal_actuator(uint8_t action, uint8_t lane) {
+  native_actuator_action = action;
+  native_actuator_lane = lane;
+  native_actuator_count++;
+}
+
+bool hal_mqtt_publish(const char *payload) {
+  native_publish_count++;
+  hal_log("mqtt publish: %s\n", payload);
+  return true;
+}
@@ -0,0 +1,154 @@
+// 在电脑上回放总线帧，检查每个应答的校验并统计处理耗时：
+//   pio run -e native
+//   .pio/build/native/program bench/fixtures/bus_polls.hex [回放次数]
+#include <chrono>
+#include <ctype.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "dispatch.h"
+#include "frame_parser.h"
+#include "hal.h"
+#include "latency.h"
+#include "metrics.h"
+#include "native.h"
+#include "protocol.h"
+#include "sniffer.h"
+
+// 每行一个帧的十六进制，# 之后是注释
+static bool load_hex(const char *path, std::vector<uint8_t> &stream) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    int high = -1;
+    for (char *p = line; *p && *p != '#'; p++) {
+      if (!isxdigit((unsigned char)*p)) {
+        continue;
+      }
+      int v = isdigit((unsigned char)*p) ? *p - '0' : tolower(*p) - 'a' + 10;
+      if (high < 0) {
+        high = v;
+      } else {
+        stream.push_back(high << 4 | v);
+        high = -1;
+      }
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static std::string frame_key(const bambu_data_t *data) {
+  char key[16];
+  if (data->type & 0x80) {
+    snprintf(key, sizeof(key), "%02x cmd %02x", data->type, data->body_80.cmd);
+  } else {
+    snprintf(key, sizeof(key), "%02x sub %02x", data->type, data->body_00.data[2]);
+  }
+  return key;
+}
+
+struct stat_t {
+  uint32_t frames = 0;
+  uint32_t replies = 0;
+  uint32_t bad_replies = 0;
+  double total_ns = 0;
+  double max_ns = 0;
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <frames.hex> [rounds] [capture]\n", argv[0]);
+    return 2;
+  }
+  std::vector<uint8_t> stream;
+  if (!load_hex(argv[1], stream)) {
+    return 1;
+  }
+  int rounds = argc > 2 ? atoi(argv[2]) : 1000;
+  native_verbose = false;
+  protocol_setup();
+  // 给了 capture 时把收发的帧写成抓包文件，可以用 tools/capture_decode 查看
+  static uint8_t sniffer_buffer[1 << 16];
+  if (argc > 3) {
+    sniffer.begin(sniffer_buffer, sizeof(sniffer_buffer));
+  }
+
+  FrameParser parser;
+  std::map<std::string, stat_t> stats;
+  auto begin = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    // 每次最多写入 32 字节，模拟 UART 的接收事件
+    size_t i = 0;
+    while (i < stream.size()) {
+      size_t n = stream.size() - i;
+      n = n < 32 ? n : 32;
+      n = n < parser.write_space() ? n : parser.write_space();
+      memcpy(parser.write_ptr(), stream.data() + i, n);
+      parser.commit(n);
+      i += n;
+      while (const bambu_data_t *data = parser.next()) {
+        stat_t &stat = stats[frame_key(data)];
+        native_uart_writes.clear();
+        auto t0 = std::chrono::steady_clock::now();
+        protocol_on_frame(data, hal_cycles());
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        stat.frames++;
+        stat.total_ns += ns;
+        stat.max_ns = ns > stat.max_ns ? ns : stat.max_ns;
+        for (const auto &reply : native_uart_writes) {
+          const bambu_data_t *r = (const bambu_data_t*)reply.data();
+          stat.replies++;
+          if (reply.size() < 2 || bambu_size(r) != reply.size() || !bambu_check(r)) {
+            stat.bad_replies++;
+          }
+        }
+      }
+    }
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  uint32_t bad = 0;
+  printf("%-12s %10s %10s %8s %10s %10s\n", "frame", "count", "replies", "bad", "avg ns", "max ns");
+  for (const auto &it : stats) {
+    const stat_t &stat = it.second;
+    printf("%-12s %10u %10u %8u %10.0f %10.0f\n", it.first.c_str(), stat.frames, stat.replies,
+           stat.bad_replies, stat.total_ns / stat.frames, stat.max_ns);
+    bad += stat.bad_replies;
+  }
+  printf("parser: frames %u, crc8 errors %u, crc16 errors %u, size errors %u, dropped bytes %u\n",
+         parser.m_frames, parser.m_crc8_errors, parser.m_crc16_errors, parser.m_size_errors, parser.m_dropped_bytes);
+  printf("dispatch: unknown %u, rejected %u\n", dispatch_unknown, metrics.frames_rejected);
+  printf("%.0f frames/s\n", parser.m_frames / elapsed);
+  printf("%-12s %10s %8s %8s %8s %8s\n", "reply", "count", "p50 us", "p99 us", "max us", "missed");
+  for (int i = 0; i < LATENCY_CMD_COUNT; i++) {
+    const latency_histogram_t *histogram = &latency_histograms[i];
+    printf("%-12s %10u %8u %8u %8u %8u\n", latency_names[i], histogram->count, latency_percentile(histogram, 50),
+           latency_percentile(histogram, 99), histogram->max_us, histogram->missed);
+  }
+  if (argc > 3) {
+    FILE *file = fopen(argv[3], "wb");
+    if (!file) {
+      perror(argv[3]);
+      return 1;
+    }
+    fwrite(SNIFFER_MAGIC, 1, sizeof(SNIFFER_MAGIC), file);
+    static uint8_t buffer[4096];
+    uint32_t cursor = sniffer.tail();
+    while (size_t n = sniffer.read(&cursor, buffer, sizeof(buffer))) {
+      fwrite(buffer, 1, n, file);
+    }
+    fclose(file);
+    printf("sniffer: %u records, %u overwritten\n", sniffer.m_records, sniffer.m_overwritten);
+  }
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// 模拟驱动记录下来的输出，供电脑上的程序检查
+
+// 每次 hal_uart_write 写出的数据
+extern std::vector<std::vector<uint8_t>> native_uart_writes;
+// 最近一次的电机动作
+extern int native_actuator_action;
+extern int native_actuator_lane;
+extern uint32_t native_actuator_count;
+extern uint32_t native_publish_count;
+// 模拟的编码器读数，native_odometer 为 false 时表示没有编码器
+extern bool native_odometer;
+extern float native_odometer_meters[4];
+// 模拟的有料与 NFC 状态，每个通道一位
+extern uint8_t native_lanes_online;
+extern uint8_t native_lanes_nfc;
+// 为 false 时不输出 hal_log
+extern bool native_verbose;
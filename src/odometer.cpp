@@ -0,0 +1,155 @@
+#include "odometer.h"
+#include <Arduino.h>
+#include <driver/pcnt.h>
+#include <soc/pcnt_struct.h>
+
+// 计数到这里时硬件清零并产生中断
+#define ODOMETER_LIMIT 30000
+// 短于这么多个 APB 周期（80MHz）的脉冲视为毛刺
+#define ODOMETER_FILTER 100
+
+typedef struct {
+  bool configured;
+  bool quadrature;
+  volatile int32_t overflow;    // 中断中累加的溢出部分
+  // 只接 A 相时，按方向折算过的计数，以及折算到的硬件读数
+  int32_t folded;
+  int32_t folded_raw;
+  int8_t direction;
+} odometer_t;
+
+static odometer_t s_odometers[ODOMETER_LANES];
+static portMUX_TYPE s_odometer_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// 计数器到达上下限（硬件已清零）而中断还没处理时，这次溢出的计数
+static int32_t IRAM_ATTR pending_overflow(uint8_t lane) {
+  uint32_t status = 0;
+  pcnt_get_event_status((pcnt_unit_t)lane, &status);
+  if (status & PCNT_EVT_H_LIM) {
+    return ODOMETER_LIMIT;
+  } else if (status & PCNT_EVT_L_LIM) {
+    return -ODOMETER_LIMIT;
+  }
+  return 0;
+}
+
+// 不用 pcnt 的 ISR 服务：它先清除中断再调用处理函数，中间读数的任务看不出有溢出没有累加。
+// 这里持有 s_odometer_mux 累加并清除中断，raw_count 看到中断标志时溢出一定还没累加
+static void IRAM_ATTR on_limit(void *arg) {
+  (void)arg;
+  portENTER_CRITICAL_ISR(&s_odometer_mux);
+  uint32_t intr = PCNT.int_st.val;
+  for (uint8_t lane = 0; lane < ODOMETER_LANES; lane++) {
+    if (intr & (1u << lane)) {
+      s_odometers[lane].overflow += pending_overflow(lane);
+    }
+  }
+  PCNT.int_clr.val = intr;
+  portEXIT_CRITICAL_ISR(&s_odometer_mux);
+}
+
+bool odometer_setup(uint8_t lane, int pin_a, int pin_b) {
+  if (lane >= ODOMETER_LANES || pin_a < 0) {
+    return false;
+  }
+  pcnt_unit_t unit = (pcnt_unit_t)lane;
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = pin_a;
+  config.ctrl_gpio_num = pin_b >= 0 ? pin_b : PCNT_PIN_NOT_USED;
+  config.channel = PCNT_CHANNEL_0;
+  config.unit = unit;
+  if (pin_b >= 0) {
+    // A 相的边沿计数，方向由 B 相的电平决定（2 倍频）
+    config.pos_mode = PCNT_COUNT_DEC;
+    config.neg_mode = PCNT_COUNT_INC;
+    config.lctrl_mode = PCNT_MODE_REVERSE;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+  } else {
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DIS;
+    config.lctrl_mode = PCNT_MODE_KEEP;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+  }
+  config.counter_h_lim = ODOMETER_LIMIT;
+  config.counter_l_lim = -ODOMETER_LIMIT;
+  if (pcnt_unit_config(&config) != ESP_OK) {
+    return false;
+  }
+  pcnt_set_filter_value(unit, ODOMETER_FILTER);
+  pcnt_filter_enable(unit);
+  pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+  pcnt_event_enable(unit, PCNT_EVT_L_LIM);
+  pcnt_counter_pause(unit);
+  pcnt_counter_clear(unit);
+  static bool s_isr_installed = false;
+  if (!s_isr_installed) {
+    pcnt_isr_register(on_limit, nullptr, 0, nullptr);
+    s_isr_installed = true;
+  }
+  pcnt_intr_enable(unit);
+  pcnt_counter_resume(unit);
+
+  odometer_t &odometer = s_odometers[lane];
+  odometer.overflow = 0;
+  odometer.folded = 0;
+  odometer.folded_raw = 0;
+  odometer.quadrature = pin_b >= 0;
+  odometer.configured = true;
+  return true;
+}
+
+bool odometer_configured(uint8_t lane) {
+  return lane < ODOMETER_LANES && s_odometers[lane].configured;
+}
+
+// 在 s_odometer_mux 中调用。计数器到达上下限后先清零，中断稍后才累加溢出
+// （本核的中断被临界区挡住，或另一核的中断在等锁），这段时间里的读数要自己计入这次溢出
+static int32_t raw_count(uint8_t lane) {
+  uint32_t mask = 1u << lane;
+  uint32_t pending;
+  int16_t value = 0;
+  // 读数前后中断标志不变，读数与溢出才对得上
+  do {
+    pending = PCNT.int_raw.val & mask;
+    pcnt_get_counter_value((pcnt_unit_t)lane, &value);
+  } while ((PCNT.int_raw.val & mask) != pending);
+  int32_t overflow = s_odometers[lane].overflow;
+  if (pending) {
+    overflow += pending_overflow(lane);
+  }
+  return overflow + value;
+}
+
+// 只接 A 相时，把上次折算以来的计数按当时的方向计入
+static void fold(odometer_t &odometer, int32_t raw) {
+  odometer.folded += (raw - odometer.folded_raw) * odometer.direction;
+  odometer.folded_raw = raw;
+}
+
+int32_t odometer_count(uint8_t lane) {
+  if (!odometer_configured(lane)) {
+    return 0;
+  }
+  odometer_t &odometer = s_odometers[lane];
+  portENTER_CRITICAL(&s_odometer_mux);
+  int32_t raw = raw_count(lane);
+  if (!odometer.quadrature) {
+    fold(odometer, raw);
+    raw = odometer.folded;
+  }
+  portEXIT_CRITICAL(&s_odometer_mux);
+  return raw;
+}
+
+void odometer_set_direction(uint8_t lane, int8_t direction) {
+  if (!odometer_configured(lane)) {
+    return;
+  }
+  odometer_t &odometer = s_odometers[lane];
+  portENTER_CRITICAL(&s_odometer_mux);
+  if (!odometer.quadrature && odometer.direction != direction) {
+    fold(odometer, raw_count(lane));
+    odometer.direction = direction;
+  }
+  portEXIT_CRITICAL(&s_odometer_mux);
+}
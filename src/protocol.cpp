@@ -0,0 +1,357 @@
+#include "protocol.h"
+#include <string.h>
+
+#include "dispatch.h"
+#include "frame_builder.h"
+#include "hal.h"
+#include "latency.h"
+#include "metrics.h"
+#include "sniffer.h"
+
+filament_t filaments[4];
+filament_ex_t filaments_ex[4];
+std::atomic<uint32_t> filaments_seq{0};
+
+// 正在处理的帧
+static int s_latency_cmd = -1;
+static uint32_t s_rx_cycles = 0;
+
+// 发送已经填好校验码的帧
+static void bambu_write(const uint8_t *data, size_t size) {
+  hal_uart_write(data, size);
+  sniffer.record(SNIFFER_TX, data, size, hal_micros());
+  metrics.replies++;
+  if (metrics.first_reply_us == 0) {
+    metrics.first_reply_us = hal_micros();
+  }
+  if (s_latency_cmd >= 0) {
+    latency_record(s_latency_cmd, (hal_cycles() - s_rx_cycles) / hal_cycles_per_us());
+    s_latency_cmd = -1;
+  }
+}
+
+void bambu_send(bambu_data_t *data) {
+  bambu_write((const uint8_t*)data, bambu_seal(data));
+}
+
+template <size_t N>
+static void bambu_write(const BambuFrame<N> &frame) {
+  bambu_write(frame.data, N);
+}
+
+uint8_t X05_MC_AP_Read_filament_res[] = {
+        0x3D, 0x00, 0x00, 0x00, 0x92, 0x00, 0x2B, 0x00,
+        0x06, 0x00, 0x12, 0x11, 0x02, 0x00, 0x02, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x47, 0x46, 0x47, 0x39, 0x39, 0x00, 0x00, 0x00,   // id
+        0x50, 0x45, 0x54, 0x47, 0x00, 0x00, 0x00, 0x00,   // name：PETG
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x16, 0x16, 0x16, 0xFF, 0x00, 0x00, 0x00, 0x00,   // 颜色
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x0E, 0x01, 0xE6, 0x00,   // 温度：[230, 270]
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00};
+void on_get_filament(const bambu_get_filament_t *req)
+{
+  uint8_t n = req->index;
+  if (req->x.item == 0x11 && n < 4) {
+    bambu_filament_res_t *res = bambu_view<bambu_filament_res_t>(X05_MC_AP_Read_filament_res);
+    const filament_t &filament = filaments[n];
+    res->index = n;
+    res->r = filament.r;
+    res->g = filament.g;
+    res->b = filament.b;
+    res->a = filament.a;
+    memcpy(res->id, filament.id, sizeof(res->id));
+    memcpy(res->name, filament.name, sizeof(res->name));
+    res->temperature_min = filament.temperature_min;
+    res->temperature_max = filament.temperature_max;
+    bambu_send((bambu_data_t*)X05_MC_AP_Read_filament_res);
+  }
+}
+
+void on_set_filament(const bambu_set_filament_t *req) {
+  if (req->filament.index >= 4) {
+    return;
+  }
+  filaments_seq.fetch_add(1, std::memory_order_acq_rel);
+  filaments[req->filament.index] = req->filament;
+  filaments_seq.fetch_add(1, std::memory_order_acq_rel);
+  static constexpr auto restuls = BambuFrame<0x08>::head_80(0xC0, 0x08).u8(5, 0x60).seal();
+  bambu_write(restuls);
+}
+
+#define C_test 0x00, 0x00, 0x00, 0xFF, \
+               0x00, 0x00, 0x80, 0xBF, \
+               0x00, 0x00, 0x00, 0xC0, \
+               0x00, 0xC0, 0x5D, 0xFF, \
+               0xFC, 0xFF, 0xFC, 0xFF, \
+               0x00, 0x00, 0x44, 0x00, \
+               0x55,                   \
+               0xC1, 0xC3, 0xEC, 0xBC, \
+               0x01, 0x01, 0x01, 0x01,
+unsigned char Dxx_res[] = {0x3D, 0xE0, 0x3C, 0x1A, 0x04,
+                           0x00, 0x00, 0x00, 0x00,
+                           0x04, 0x04, 0x04, 0xFF, // flags
+                           0x00, 0x00, 0x00, 0x00,
+                           C_test 0x00, 0x00, 0x00, 0x00,
+                           0x64, 0x64, 0x64, 0x64,
+                           0x90, 0xE4};
+uint8_t packge_num = 0;
+
+
+
+int now_filament_num = -1;
+int last_time = 0;
+unsigned char Cxx_res[] = {0x3D, 0xE0, 0x2C, 0x1A, 0x03,
+                           C_test 0x00, 0x00, 0x00, 0x00,
+                           0x90, 0xE4};
+
+// 查询里程与查询状态都带着打印机要求的动作，转交主循环驱动电机，并返回通道的送料长度。
+// 有编码器时是实测值；没有时按时间估算，只在退料时累计。换了通道从 0 开始算。
+static float on_motion(uint8_t read_num, uint8_t motion) {
+  filament_ex_t &ex = filaments_ex[read_num];
+  ex.motion_set = motion;
+  float odometer = 0;
+  bool measured = hal_feed_meters(read_num, &odometer);
+  int now_time = hal_millis();
+  if (read_num != now_filament_num) {
+    now_filament_num = read_num;
+    ex.meters = 0;
+    ex.odometer_base = odometer;
+    last_time = now_time;
+  }
+  if (measured) {
+    ex.meters = odometer - ex.odometer_base;
+  } else if (motion == 0x3f) {
+    ex.meters -= (now_time - last_time) / 1000.0 * 5.0;
+  }
+  last_time = now_time;
+  // 没有电机的通道由主循环忽略
+  if (motion == 0x3f) {          // 请求退料
+    hal_bus_actuator(ACTUATOR_BACKWARD, read_num);
+  } else if (motion == 0xbf) {   // 请求进料
+    hal_bus_actuator(ACTUATOR_FORWARD, read_num);
+  } else {
+    hal_bus_actuator(ACTUATOR_STOP, read_num);
+  }
+  return ex.meters;
+}
+
+void protocol_filaments(filament_t out[4]) {
+  // 写入很少且很快，读到一半被改写时重读
+  for (;;) {
+    uint32_t seq = filaments_seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      continue;
+    }
+    memcpy(out, filaments, sizeof(filaments));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (filaments_seq.load(std::memory_order_relaxed) == seq) {
+      return;
+    }
+  }
+}
+
+int protocol_active_lane() {
+  return now_filament_num;
+}
+
+void protocol_restore_filament(const filament_t &filament) {
+  if (filament.index < 4) {
+    filaments[filament.index] = filament;
+  }
+}
+
+void protocol_restore_meters(int lane, float meters) {
+  if (lane < 0 || lane >= 4) {
+    return;
+  }
+  float odometer = 0;
+  hal_feed_meters(lane, &odometer);
+  now_filament_num = lane;
+  last_time = hal_millis();
+  filaments_ex[lane].meters = meters;
+  filaments_ex[lane].odometer_base = odometer - meters;
+}
+
+void on_get_meters(const bambu_get_meters_t *req) {
+  bambu_meters_res_t *res = bambu_view<bambu_meters_res_t>(Cxx_res);
+  res->h.type = 0xC0 | (packge_num << 3);
+
+  uint8_t read_num = req->read_num;
+  float meters = -1;
+  if (read_num < 4) {
+    meters = on_motion(read_num, req->motion);
+  }
+  res->flag = 0x02;
+  res->read_num = read_num;
+  res->meters = meters;
+
+  bambu_send((bambu_data_t*)Cxx_res);
+  packge_num = (packge_num + 1) % 8;
+}
+
+
+void on_get_status(const bambu_get_status_t *req) {
+  unsigned char filament_flag_on = 0x00;
+  unsigned char filament_flag_NFC = 0x00;
+  unsigned char read_num = req->read_num;
+  float meters = -1;
+
+  hal_lane_flags(&filament_flag_on, &filament_flag_NFC);
+
+  if (read_num < 4) {
+    meters = on_motion(read_num, req->motion);
+  }
+
+  bambu_status_res_t *res = bambu_view<bambu_status_res_t>(Dxx_res);
+  res->h.type = 0xC0 | (packge_num << 3);
+  res->online = filament_flag_on;
+  res->ready[0] = filament_flag_on & ~filament_flag_NFC;
+  res->ready[1] = filament_flag_on & ~filament_flag_NFC;
+  res->flag = 0x02;
+  res->read_num2 = res->read_num = read_num;
+  res->nfc = filament_flag_NFC;
+  res->meters = meters;
+  bambu_send((bambu_data_t*)Dxx_res);
+  packge_num = (packge_num + 1) % 8;
+}
+
+static BambuFrame<0x0D> NFC_detect_res = BambuFrame<0x0D>::head_80(0xC0, 0x07).bytes(5, {0x00, 0x03, 0x01}).seal();
+void on_NFC_detect(const bambu_nfc_detect_t *req) {
+  NFC_detect_res.set_body<6>(req->echo[0]);
+  NFC_detect_res.set_body<7>(req->echo[1]);
+  bambu_write(NFC_detect_res);
+}
+
+
+// 只有序号随请求变化，用 set_seq 增量更新校验码
+static BambuFrame<0x48> X05_AP2_res_03 = BambuFrame<0x48>::head_00(0x00, 0x6A, 0x00)
+    .bytes(8, {0x09, 0x00, 0x12, 0x03, 0x01})
+    .bytes(13, {92, 07, 00, 00})      // 我们伪装(AMS Lite)的版本: 00.00.07.92
+    .str(17, "AMS_F102")
+    .seal();
+static BambuFrame<0x51> X05_AP2_res_02 = BambuFrame<0x51>::head_00(0x00, 0xB3, 0x00)
+    .bytes(8, {0x09, 0x00, 0x12, 0x02, 0x04, 0x0F})
+    .str(14, "03C12A3C0400529")       // 我们伪装(AMS Lite)的序列号
+    .bytes(46, {0x9B})
+    .str(47, "13465")
+    .bytes(52, {0x02, 0x00})
+    .str(54, "7938")
+    .bytes(58, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                0xBB, 0x44, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF})
+    .seal();
+void on_get_version(const bambu_get_version_t *req) {
+  if (req->item == 0x02) {
+    // 硬件序列号
+    X05_AP2_res_02.set_seq(req->h.seq);
+    bambu_write(X05_AP2_res_02);
+  } else if (req->item == 0x03) {
+    // 固件版本
+    X05_AP2_res_03.set_seq(req->h.seq);
+    bambu_write(X05_AP2_res_03);
+  }
+}
+
+static constexpr auto X05_MC_res = BambuFrame<0x15>::head_00(0x00, 0x00, 0x00)
+    .bytes(8, {0x03, 0x00, 0x12, 0x1A, 0x02})
+    .seal();
+void send_for_X05_MC() {
+    bambu_write(X05_MC_res);
+}
+
+unsigned char REQx6_res[] = {0x3D, 0xE0, 0x3C, 0x1A, 0x06,
+                             0x00, 0x00, 0x00, 0x00,
+                             0x04, 0x04, 0x04, 0xFF, // flags
+                             0x00, 0x00, 0x00, 0x00,
+                             C_test 0x00, 0x00, 0x00, 0x00,
+                             0x64, 0x64, 0x64, 0x64,
+                             0x90, 0xE4};
+
+// 与查询状态的应答相同，只是不带里程
+void on_cmd_06(const bambu_cmd_06_t *req) {
+  uint8_t online = 0;
+  uint8_t nfc = 0;
+  hal_lane_flags(&online, &nfc);
+  bambu_status_res_t *res = bambu_view<bambu_status_res_t>(REQx6_res);
+  res->h.type = 0xC0 | (packge_num << 3);
+  res->online = online;
+  res->ready[0] = online & ~nfc;
+  res->ready[1] = online & ~nfc;
+  res->read_num = req->read_num;
+  res->nfc = nfc;
+  bambu_send((bambu_data_t*)REQx6_res);
+  packge_num = (packge_num + 1) % 8;
+}
+
+void on_online_detection(const bambu_online_detection_t *req) {
+  if (req->query[0] == 0x01 && req->query[1] == 0x00) {
+    static constexpr auto restuls = BambuFrame<0x1D>::head_80(0xC0, 0x05).u8(5, 0x01).seal();
+    bambu_write(restuls);
+  }
+}
+
+// 帧长不够的帧计数后丢弃，不交给处理函数
+template <typename T, void (*Handler)(const T*)>
+static void typed(const bambu_data_t *data) {
+  const T *view = bambu_view<T>(data);
+  if (view) {
+    Handler(view);
+  } else {
+    metrics.frames_rejected++;
+  }
+}
+
+static void ignore(const bambu_data_t *data) {
+  (void)data;
+}
+
+// 以下帧的日志由主循环从 hal_monitor_frame 转交的帧中打印，串口输出会拖慢应答
+// 打印机告诉我们耗材类型
+static void on_set_filament_frame(const bambu_data_t *data) {
+  typed<bambu_set_filament_t, on_set_filament>(data);
+}
+
+static void on_NFC_detect_frame(const bambu_data_t *data) {
+  (void)data;
+  // typed<bambu_nfc_detect_t, on_NFC_detect>(data);
+}
+
+static void on_get_filament_frame(const bambu_data_t *data) {
+  typed<bambu_get_filament_t, on_get_filament>(data);
+}
+
+void protocol_setup() {
+  dispatch_register(0xC5, 0x20, ignore);      // 心跳
+  dispatch_register(0xC5, 0x03, typed<bambu_get_meters_t, on_get_meters>);
+  dispatch_register(0xC5, 0x04, typed<bambu_get_status_t, on_get_status>);
+  dispatch_register(0xC5, 0x05, typed<bambu_online_detection_t, on_online_detection>);
+  dispatch_register(0xC5, 0x06, typed<bambu_cmd_06_t, on_cmd_06>);
+  dispatch_register(0xC5, 0x07, on_NFC_detect_frame);
+  dispatch_register(0xC5, 0x08, on_set_filament_frame);
+  dispatch_register(0x05, 0x03, ignore);      // 还不知道是什么，应答见 send_for_X05_MC
+  dispatch_register(0x05, 0x06, on_get_filament_frame);
+  dispatch_register(0x05, 0x09, typed<bambu_get_version_t, on_get_version>);
+}
+
+void protocol_on_frame(const bambu_data_t *bambu_data, uint32_t rx_cycles) {
+  s_latency_cmd = latency_cmd(bambu_data);
+  s_rx_cycles = rx_cycles;
+  uint32_t rx_us = hal_micros() - (hal_cycles() - rx_cycles) / hal_cycles_per_us();
+  sniffer.record(SNIFFER_RX, (const uint8_t*)bambu_data, bambu_size(bambu_data), rx_us);
+  metrics_count_frame(bambu_data);
+  // 0x20 是心跳信号，可以忽略啦；其余的帧由网页推送合并，每个周期只发最后一个
+  if ((bambu_data->type == 0xc5 && bambu_data->body_80.cmd != 0x20) || bambu_data->type == 0x05) {
+    hal_monitor_frame(bambu_data);
+  }
+  dispatch_frame(bambu_data);
+}
@@ -2,15 +2,19 @@
 #include "setups.h"
 #include <LittleFS.h>
 
+static bool s_time_synced = false;
+
 void time_setup() {
   // 获取时间
   configTime(8 * 60 * 60, 0, "pool.ntp.org");
+}
+
+void time_poll() {
   struct tm now;
-  if (getLocalTime(&now)) {
+  if (!s_time_synced && getLocalTime(&now, 0)) {
+    s_time_synced = true;
     Serial.print("Time synced successfully, ");
     Serial.println(&now);
-  } else {
-    Serial.println("Time synced failure!");
   }
 }
 
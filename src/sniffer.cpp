@@ -0,0 +1,79 @@
+#include "sniffer.h"
+#include <string.h>
+
+SnifferRing sniffer;
+volatile bool sniffer_enabled = true;
+
+void SnifferRing::begin(uint8_t *buffer, size_t capacity) {
+  m_capacity = capacity;
+  m_head = m_tail = 0;
+  __atomic_store_n(&m_buffer, buffer, __ATOMIC_RELEASE);
+}
+
+void SnifferRing::copy_out(uint32_t pos, uint8_t *out, size_t n) const {
+  size_t i = pos & (m_capacity - 1);
+  size_t first = n < m_capacity - i ? n : m_capacity - i;
+  memcpy(out, m_buffer + i, first);
+  memcpy(out + first, m_buffer, n - first);
+}
+
+void SnifferRing::record(uint8_t dir, const uint8_t *data, size_t size, uint32_t us) {
+  if (m_buffer == nullptr || !sniffer_enabled) {
+    return;
+  }
+  sniffer_record_t header = {us, dir, (uint8_t)size};
+  uint32_t len = sizeof(header) + header.size;
+  // 先移动 m_tail 再覆盖，读者复制完后检查 m_tail 就能发现记录已被覆盖
+  uint32_t tail = m_tail;
+  while (m_head + len - tail > m_capacity) {
+    sniffer_record_t oldest;
+    copy_out(tail, (uint8_t*)&oldest, sizeof(oldest));
+    tail += sizeof(oldest) + oldest.size;
+    m_overwritten++;
+  }
+  if (tail != m_tail) {
+    __atomic_store_n(&m_tail, tail, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+  size_t i = m_head & (m_capacity - 1);
+  for (size_t k = 0; k < sizeof(header); k++) {
+    m_buffer[(i + k) & (m_capacity - 1)] = ((const uint8_t*)&header)[k];
+  }
+  i = (i + sizeof(header)) & (m_capacity - 1);
+  size_t first = header.size < m_capacity - i ? header.size : m_capacity - i;
+  memcpy(m_buffer + i, data, first);
+  memcpy(m_buffer, data + first, header.size - first);
+  m_records++;
+  __atomic_store_n(&m_head, m_head + len, __ATOMIC_RELEASE);
+}
+
+size_t SnifferRing::read(uint32_t *cursor, uint8_t *buffer, size_t size) {
+  if (m_buffer == nullptr) {
+    return 0;
+  }
+  uint32_t pos = *cursor;
+  uint32_t head = this->head();
+  size_t n = 0;
+  while (pos != head) {
+    if ((int32_t)(pos - tail()) < 0) {
+      pos = tail();
+      continue;
+    }
+    sniffer_record_t header;
+    copy_out(pos, (uint8_t*)&header, sizeof(header));
+    size_t len = sizeof(header) + header.size;
+    if (n + len > size) {
+      break;
+    }
+    copy_out(pos, buffer + n, len);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((int32_t)(pos - tail()) < 0) {
+      // 复制期间被覆盖了
+      continue;
+    }
+    n += len;
+    pos += len;
+  }
+  *cursor = pos;
+  return n;
+}
@@ -0,0 +1,174 @@
+#include "swap_profiler.h"
+#include <string.h>
+
+#include "hal.h"
+
+SwapProfiler swap_profiler;
+
+static const char* const s_phase_names[SWAP_PHASES] = {
+  "wait", "heating", "cutting", "pull", "push", "detected", "purge", "unloaded", "other",
+};
+
+const char* swap_phase_name(uint8_t phase) {
+  return phase < SWAP_PHASES ? s_phase_names[phase] : "";
+}
+
+static uint8_t phase_of(int ams_status) {
+  switch (ams_status) {
+    case 258: return SWAP_HEATING;
+    case 259: return SWAP_CUTTING;
+    case 260: return SWAP_PULL;
+    case 261: return SWAP_PUSH;
+    case 262: return SWAP_DETECTED;
+    case 263: return SWAP_PURGE;
+    case 0: return SWAP_UNLOADED;
+  }
+  return SWAP_OTHER;
+}
+
+void SwapProfiler::begin(int from_lane, int to_lane, uint32_t now) {
+  if (m_active) {
+    finish(false, now);
+  }
+  write_begin();
+  memset(&m_current, 0, sizeof(m_current));
+  m_current.id = m_next_id++;
+  m_current.start_ms = now;
+  m_current.from_lane = from_lane;
+  m_current.to_lane = to_lane;
+  m_active = true;
+  m_phase = SWAP_WAIT;
+  m_status = -1;
+  m_phase_start = now;
+  m_visited = 1 << SWAP_WAIT;
+  m_motor_since = now;
+  write_end();
+}
+
+void SwapProfiler::status(int ams_status, int from_lane, int to_lane, uint32_t now) {
+  if (m_active && now - m_phase_start >= SWAP_TIMEOUT_MS) {
+    finish(false, m_phase_start);
+  }
+  if (!m_active) {
+    if (ams_status < 258 || ams_status > 263) {
+      return;
+    }
+    // 不是我们发起的换料，例如网页上的进料、退料
+    begin(from_lane, to_lane, now);
+  }
+  if (ams_status == m_status) {
+    // 同一个状态会在多条 report 中重复出现
+    return;
+  }
+  m_status = ams_status;
+  if (ams_status == 768) {
+    finish(true, now);
+    return;
+  }
+  enter(phase_of(ams_status), ams_status, now);
+}
+
+void SwapProfiler::enter(uint8_t phase, uint16_t ams_status, uint32_t now) {
+  write_begin();
+  m_current.phase_ms[m_phase] += now - m_phase_start;
+  if (m_visited & (1 << phase)) {
+    m_current.retries++;
+  }
+  m_visited |= 1 << phase;
+  m_phase = phase;
+  m_phase_start = now;
+  if (m_current.transition_count < SWAP_MAX_TRANSITIONS) {
+    swap_transition_t &transition = m_current.transitions[m_current.transition_count++];
+    transition.ams_status = ams_status;
+    transition.at_ms = now - m_current.start_ms;
+  }
+  write_end();
+}
+
+void SwapProfiler::error(uint32_t now) {
+  (void)now;
+  if (m_active) {
+    write_begin();
+    m_current.errors++;
+    write_end();
+  }
+}
+
+void SwapProfiler::motor(bool running, uint32_t now) {
+  if (running == m_motor_running) {
+    return;
+  }
+  if (m_active) {
+    write_begin();
+    if (m_motor_running) {
+      m_current.motor_ms += now - m_motor_since;
+    }
+    write_end();
+  }
+  m_motor_running = running;
+  m_motor_since = now;
+}
+
+void SwapProfiler::finish(bool completed, uint32_t now) {
+  write_begin();
+  swap_record_t &record = m_current;
+  record.phase_ms[m_phase] += now - m_phase_start;
+  if (m_motor_running) {
+    record.motor_ms += now - m_motor_since;
+    m_motor_since = now;
+  }
+  record.total_ms = now - record.start_ms;
+  record.completed = completed;
+  if (completed && record.transition_count < SWAP_MAX_TRANSITIONS) {
+    swap_transition_t &transition = record.transitions[record.transition_count++];
+    transition.ams_status = 768;
+    transition.at_ms = record.total_ms;
+  }
+
+  swap_totals_t &totals = m_totals;
+  totals.swaps++;
+  if (completed) {
+    totals.completed++;
+    totals.total_ms += record.total_ms;
+    if (record.total_ms > totals.max_ms) {
+      totals.max_ms = record.total_ms;
+    }
+  }
+  for (int i = 0; i < SWAP_PHASES; i++) {
+    totals.phase_ms[i] += record.phase_ms[i];
+    if (record.phase_ms[i] > totals.phase_max_ms[i]) {
+      totals.phase_max_ms[i] = record.phase_ms[i];
+    }
+  }
+  totals.motor_ms += record.motor_ms;
+  totals.retries += record.retries;
+  totals.errors += record.errors;
+
+  m_records[m_head] = record;
+  m_head = (m_head + 1) % SWAP_HISTORY;
+  if (m_count < SWAP_HISTORY) {
+    m_count++;
+  }
+  m_active = false;
+  write_end();
+
+  hal_log("swap %u: %d -> %d %s in %u ms, motor %u ms, retries %u\n", (unsigned)record.id, record.from_lane,
+          record.to_lane, completed ? "done" : "abandoned", (unsigned)record.total_ms, (unsigned)record.motor_ms,
+          record.retries);
+}
+
+void SwapProfiler::snapshot(swap_snapshot_t *out) const {
+  // 只是几 KB 的复制，关中断的时间在几十微秒以内
+  hal_critical_enter();
+  size_t first = (m_head + SWAP_HISTORY - m_count) % SWAP_HISTORY;
+  out->count = m_count;
+  for (size_t i = 0; i < m_count; i++) {
+    out->records[i] = m_records[(first + i) % SWAP_HISTORY];
+  }
+  out->active = m_active;
+  out->current = m_current;
+  out->phase = m_phase;
+  out->phase_start = m_phase_start;
+  out->totals = m_totals;
+  hal_critical_exit();
+}
@@ -0,0 +1,79 @@
+#include "web_assets.h"
+#include <ArduinoJson.h>
+
+uint32_t web_assets_sent = 0;
+uint32_t web_assets_not_modified = 0;
+
+typedef struct {
+  String path;      // 网址
+  String file;      // 文件系统中的路径
+  String type;
+  String etag;      // 带引号
+  bool gzip;
+} web_asset_t;
+
+static fs::FS *s_fs = nullptr;
+static web_asset_t s_assets[WEB_ASSETS_MAX];
+static size_t s_count = 0;
+
+static void add_headers(AsyncWebServerResponse *response, const web_asset_t &asset) {
+  response->addHeader("ETag", asset.etag);
+  response->addHeader("Cache-Control", WEB_CACHE_CONTROL);
+}
+
+static void send_asset(AsyncWebServerRequest *request, const web_asset_t &asset) {
+  if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == asset.etag) {
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    add_headers(response, asset);
+    request->send(response);
+    web_assets_not_modified++;
+    return;
+  }
+  AsyncWebServerResponse *response = request->beginResponse(*s_fs, asset.file, asset.type);
+  if (asset.gzip) {
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  add_headers(response, asset);
+  request->send(response);
+  web_assets_sent++;
+}
+
+bool web_assets_setup(AsyncWebServer &server, fs::FS &fs) {
+  File file = fs.open(WEB_ASSETS_MANIFEST, "r");
+  if (!file) {
+    return false;
+  }
+  JsonDocument manifest;
+  DeserializationError error = deserializeJson(manifest, file);
+  file.close();
+  if (error || !manifest.is<JsonArray>()) {
+    Serial.printf("Bad %s: %s\n", WEB_ASSETS_MANIFEST, error.c_str());
+    return false;
+  }
+  s_fs = &fs;
+  for (JsonObject item : manifest.as<JsonArray>()) {
+    if (s_count >= WEB_ASSETS_MAX) {
+      Serial.println("Too many web assets");
+      break;
+    }
+    web_asset_t &asset = s_assets[s_count];
+    asset.path = item["path"] | "";
+    asset.type = item["type"] | "application/octet-stream";
+    asset.etag = item["etag"] | "";
+    asset.gzip = item["gzip"] | false;
+    asset.file = String(WEB_ASSETS_DIR) + asset.path + (asset.gzip ? ".gz" : "");
+    if (asset.path.isEmpty() || asset.etag.isEmpty()) {
+      continue;
+    }
+    server.on(asset.path.c_str(), HTTP_GET, [&asset](AsyncWebServerRequest *request) {
+      send_asset(request, asset);
+    });
+    if (asset.path == "/index.html") {
+      server.on("/", HTTP_GET, [&asset](AsyncWebServerRequest *request) {
+        send_asset(request, asset);
+      });
+    }
+    s_count++;
+  }
+  return true;
+}
@@ -0,0 +1,105 @@
+#include "web_state.h"
+#include <stdio.h>
+#include <string.h>
+
+WebState web_state;
+
+void WebState::set(const char *key, int value) {
+  char text[VALUE_SIZE];
+  snprintf(text, sizeof(text), "%d", value);
+  set_raw(key, text);
+}
+
+void WebState::set(const char *key, const char *value) {
+  static const char digits[] = "0123456789abcdef";
+  char text[VALUE_SIZE];
+  size_t n = 0;
+  text[n++] = '"';
+  // 留出结尾的引号和 0
+  for (; *value && n + 2 < sizeof(text); value++) {
+    unsigned char c = *value;
+    if (c == '"' || c == '\\') {
+      if (n + 3 >= sizeof(text)) {
+        break;
+      }
+      text[n++] = '\\';
+      text[n++] = c;
+    } else if (c < 0x20) {
+      if (n + 7 >= sizeof(text)) {
+        break;
+      }
+      memcpy(text + n, "\\u00", 4);
+      text[n + 4] = digits[c >> 4];
+      text[n + 5] = digits[c & 0x0f];
+      n += 6;
+    } else {
+      text[n++] = c;
+    }
+  }
+  text[n++] = '"';
+  text[n] = 0;
+  set_raw(key, text);
+}
+
+void WebState::set_raw(const char *key, const char *value) {
+  field_t *field = nullptr;
+  for (size_t i = 0; i < m_count; i++) {
+    if (strcmp(m_fields[i].key, key) == 0) {
+      field = &m_fields[i];
+      break;
+    }
+  }
+  if (field == nullptr) {
+    if (m_count == FIELDS) {
+      return;
+    }
+    field = &m_fields[m_count++];
+    field->key = key;
+    field->value[0] = 0;
+    field->dirty = false;
+  }
+  if (strcmp(field->value, value) == 0) {
+    return;
+  }
+  if (field->dirty) {
+    m_coalesced++;
+  }
+  strcpy(field->value, value);
+  field->dirty = true;
+}
+
+bool WebState::dirty() const {
+  for (size_t i = 0; i < m_count; i++) {
+    if (m_fields[i].dirty) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void WebState::clear_dirty() {
+  for (size_t i = 0; i < m_count; i++) {
+    m_fields[i].dirty = false;
+  }
+}
+
+size_t WebState::render(char *buffer, size_t size, bool full) const {
+  size_t n = 0;
+  for (size_t i = 0; i < m_count; i++) {
+    const field_t &field = m_fields[i];
+    if (!full && !field.dirty) {
+      continue;
+    }
+    int k = snprintf(buffer + n, size - n, "%s\"%s\": %s", n ? ", " : "{", field.key, field.value);
+    if (k < 0 || n + k >= size) {
+      return 0;
+    }
+    n += k;
+  }
+  if (n == 0 || n + 2 > size) {
+    return 0;
+  }
+  buffer[n++] = '}';
+  buffer[n] = 0;
+  return n;
+}
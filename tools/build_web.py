@@ -0,0 +1,77 @@
+# 把 data/ 中的网页文件精简、gzip 后放到 LittleFS 镜像的 www/ 下，并生成清单 www/manifest.json，
+# 固件据此注册路由，应答带 ETag，浏览器再次访问时直接回 304（见 include/web_assets.h）。
+# 由 platformio.ini 中的 extra_scripts 在每次构建前运行；也可以单独运行：
+#   python3 tools/build_web.py data .pio/data
+import gzip
+import hashlib
+import json
+import mimetypes
+import os
+import re
+import shutil
+import sys
+
+ASSETS_DIR = "www"
+
+TYPES = {
+    ".html": "text/html",
+    ".htm": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+}
+TEXT_TYPES = (".html", ".htm", ".css", ".js", ".svg")
+
+
+def minify(text):
+    # 只做不会改变含义的精简：去掉 HTML 注释、每行首尾的空白与空行。
+    # 不合并行，脚本中省略分号的语句不受影响
+    text = re.sub(r"<!--(?!\[).*?-->", "", text, flags=re.S)
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line) + "\n"
+
+
+def build(src, dst):
+    out = os.path.join(dst, ASSETS_DIR)
+    shutil.rmtree(out, ignore_errors=True)
+    os.makedirs(out)
+    manifest = []
+    for root, _, files in os.walk(src):
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            url = "/" + os.path.relpath(path, src).replace(os.sep, "/")
+            ext = os.path.splitext(name)[1].lower()
+            with open(path, "rb") as f:
+                data = f.read()
+            if ext in TEXT_TYPES:
+                data = minify(data.decode("utf-8")).encode("utf-8")
+            # mtime 固定为 0，内容不变时压缩结果与 ETag 也不变
+            packed = gzip.compress(data, 9, mtime=0)
+            use_gzip = len(packed) < len(data)
+            body = packed if use_gzip else data
+            target = os.path.join(out, url.lstrip("/") + (".gz" if use_gzip else ""))
+            os.makedirs(os.path.dirname(target), exist_ok=True)
+            with open(target, "wb") as f:
+                f.write(body)
+            manifest.append({
+                "path": url,
+                "type": TYPES.get(ext) or mimetypes.guess_type(name)[0] or "application/octet-stream",
+                "gzip": use_gzip,
+                "etag": '"%s"' % hashlib.sha256(body).hexdigest()[:16],
+            })
+            print("web: %s %d -> %d bytes" % (url, os.path.getsize(path), len(body)))
+    with open(os.path.join(out, "manifest.json"), "w") as f:
+        json.dump(manifest, f, separators=(",", ":"))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("usage: build_web.py <src> <dst>")
+    build(sys.argv[1], sys.argv[2])
+else:
+    # 由 PlatformIO 作为 extra_scripts 运行，输出到 data_dir
+    Import("env")
+    build(os.path.join(env.subst("$PROJECT_DIR"), "data"), env.subst("$PROJECT_DATA_DIR"))
@@ -0,0 +1,128 @@
+// 解析 /capture 下载的抓包文件（或 /sniffer 收到的二进制消息拼接成的文件），在电脑上运行：
+//   g++ -std=c++17 -O2 -Iinclude tools/capture_decode.cpp src/bambu_frame.cpp -o capture_decode
+//   ./capture_decode amslite.bblcap
+// 每行一帧：时间、方向、与上一帧的间隔、命令及已知字段、原始数据。
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "bambu_frame.h"
+#include "bambu_views.h"
+#include "sniffer.h"
+
+static const char* motion_name(uint8_t motion) {
+  switch (motion) {
+    case 0x3f: return "退料";
+    case 0xbf: return "进料";
+  }
+  return "停止";
+}
+
+static void describe(uint8_t dir, const bambu_data_t *data) {
+  if (!bambu_check(data)) {
+    printf("校验错误");
+    return;
+  }
+  if (data->type & 0x80) {
+    uint8_t cmd = data->body_80.cmd;
+    printf("type %02x cmd %02x", data->type, cmd);
+    if (dir == SNIFFER_RX) {
+      if (cmd == 0x03) {
+        if (const bambu_get_meters_t *req = bambu_view<bambu_get_meters_t>(data)) {
+          printf(" 查询里程 通道 %u %s", req->read_num, motion_name(req->motion));
+        }
+      } else if (cmd == 0x04) {
+        if (const bambu_get_status_t *req = bambu_view<bambu_get_status_t>(data)) {
+          printf(" 查询状态 通道 %u %s", req->read_num, motion_name(req->motion));
+        }
+      } else if (cmd == 0x05) {
+        printf(" 上线检测");
+      } else if (cmd == 0x06) {
+        if (const bambu_cmd_06_t *req = bambu_view<bambu_cmd_06_t>(data)) {
+          printf(" 查询通道 %u", req->read_num);
+        }
+      } else if (cmd == 0x08) {
+        if (const bambu_set_filament_t *req = bambu_view<bambu_set_filament_t>(data)) {
+          printf(" 设置耗材 通道 %u %.20s #%02x%02x%02x%02x %u-%u", req->filament.index, (const char*)req->filament.name,
+                 req->filament.r, req->filament.g, req->filament.b, req->filament.a,
+                 req->filament.temperature_min, req->filament.temperature_max);
+        }
+      } else if (cmd == 0x20) {
+        printf(" 心跳");
+      }
+    } else {
+      if (cmd == 0x03 && bambu_size(data) == sizeof(bambu_meters_res_t)) {
+        const bambu_meters_res_t *res = (const bambu_meters_res_t*)data;
+        printf(" 里程 通道 %u %.2f m", res->read_num, res->meters);
+      } else if ((cmd == 0x04 || cmd == 0x06) && bambu_size(data) == sizeof(bambu_status_res_t)) {
+        const bambu_status_res_t *res = (const bambu_status_res_t*)data;
+        printf(" 状态 在线 %x NFC %x 通道 %u %.2f m", res->online, res->nfc, res->read_num, res->meters);
+      }
+    }
+  } else {
+    printf("type %02x seq %02x", data->type, data->body_00.temp2);
+    if (dir == SNIFFER_RX) {
+      if (const bambu_x05_t *x05 = bambu_view<bambu_x05_t>(data)) {
+        printf(" 子命令 %02x/%02x", x05->sub, x05->item);
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <capture>\n", argv[0]);
+    return 2;
+  }
+  FILE *file = fopen(argv[1], "rb");
+  if (!file) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    bytes.insert(bytes.end(), chunk, chunk + n);
+  }
+  fclose(file);
+
+  size_t pos = 0;
+  if (bytes.size() >= sizeof(SNIFFER_MAGIC) && memcmp(bytes.data(), SNIFFER_MAGIC, sizeof(SNIFFER_MAGIC)) == 0) {
+    pos = sizeof(SNIFFER_MAGIC);
+  }
+  uint32_t first_us = 0;
+  uint32_t last_us = 0;
+  uint32_t records = 0;
+  while (pos + sizeof(sniffer_record_t) <= bytes.size()) {
+    sniffer_record_t record;
+    memcpy(&record, bytes.data() + pos, sizeof(record));
+    pos += sizeof(record);
+    if (pos + record.size > bytes.size()) {
+      fprintf(stderr, "记录不完整，位置 %zu\n", pos);
+      break;
+    }
+    // 复制到对齐的缓冲区，末尾留出视图可能读到的空间
+    uint8_t frame[256 + 64] = {};
+    memcpy(frame, bytes.data() + pos, record.size);
+    pos += record.size;
+    if (records == 0) {
+      first_us = last_us = record.us;
+    }
+    printf("%10.3f ms %s %+8d us  ", (record.us - first_us) / 1000.0, record.dir == SNIFFER_TX ? "TX" : "RX",
+           (int32_t)(record.us - last_us));
+    last_us = record.us;
+    const bambu_data_t *data = (const bambu_data_t*)frame;
+    if (record.size < 4 || data->head != BAMBU_HEAD || bambu_size(data) != record.size) {
+      printf("不是完整的帧");
+    } else {
+      describe(record.dir, data);
+    }
+    char hex[256 * 2 + 1];
+    bambu_to_hex(frame, record.size, hex);
+    printf("  %s\n", hex);
+    records++;
+  }
+  printf("%u 帧\n", records);
+  return 0;
+}